@@ -7,10 +7,19 @@
 #include <dirent.h>
 #include <lo/lo.h>
 #include <unistd.h>
+#include <limits.h>
+#include <stdint.h>
 
 #include "common.h"
 #include "config.h"
 #include "thpool.h"
+#include "kernels.h"
+#include "renderpool.h"
+#include "mpsc.h"
+#include "audioclock.h"
+#include "dynamics.h"
+#include "governor.h"
+#include "rendercache.h"
 
 #ifdef JACK
 #include "jack.h"
@@ -38,30 +47,100 @@ PaStream *stream;
 
 #define HALF_PI 1.5707963267948966f
 
-t_line* delays;
-float line_feedback_delay;
+// each orbit's delay, only given lines once a sound sends to it
+static t_delay delays[MAX_ORBIT];
+
 
 pthread_mutex_t queue_loading_lock;
-pthread_mutex_t queue_waiting_lock;
-pthread_mutex_t mutex_sounds;
 
 t_sound *loading = NULL;
-t_sound *waiting = NULL;
-t_sound *playing = NULL;
+// sounds ready to play, on their way to the audio thread
+static mpsc_t *incoming = NULL;
+
+// Sounds waiting to start, as a binary heap ordered by start time and
+// then by arrival, so sounds due at the same time start in the order
+// they were triggered. Only touched by the audio thread.
+typedef struct {
+  sampletime_t startT;
+  unsigned int seq;
+  t_sound *sound;
+} t_waiting;
+
+static t_waiting waiting[MAX_SOUNDS];
+static int waiting_n = 0;
+static unsigned int waiting_seq = 0;
 
 t_sound sounds[MAX_SOUNDS];
-int playing_n = 0;
 
-double epochOffset = 0;
+// The free slots in sounds[], as a lock-free stack linked through
+// sound_free_next. The low 32 bits of sound_free_head are the top slot,
+// the high 32 bits count pushes, so that a pop can't be fooled by its
+// top slot being taken and pushed back in the meantime. new_sound()
+// pops from the OSC thread, finished sounds are pushed back from the
+// audio and file loading threads.
+#define NO_SOUND 0xffffffffu
+static uint32_t sound_free_next[MAX_SOUNDS];
+static uint64_t sound_free_head = NO_SOUND;
+
+// gives a sound's slot back to the free list
+static void free_sound(t_sound *sound) {
+  uint32_t i = (uint32_t) (sound - sounds);
+  uint64_t head = __atomic_load_n(&sound_free_head, __ATOMIC_RELAXED);
+  uint64_t top;
+
+  do {
+    __atomic_store_n(&sound_free_next[i], (uint32_t) head, __ATOMIC_RELAXED);
+    top = (((head >> 32) + 1) << 32) | i;
+  } while (!__atomic_compare_exchange_n(&sound_free_head, &head, top, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+// render state of the playing sounds, packed at the start of the
+// array in the order they started. only touched by the audio thread.
+static t_voice voices[MAX_SOUNDS];
+static int voices_n = 0;
+// how many of those are due to end within ROUNDOFF frames
+static int voices_dying = 0;
+
+// sounds merged into duplicates started at the same time
+static unsigned long merged = 0;
+
+// The playing voices in each cut group are listed in a hash table,
+// keyed on the group, and the sample too for negative groups, so a cut
+// only looks at the voices it may affect. Each bucket lists voices by
+// index, in the order they started. The lists are built up as voices
+// start, and rebuilt as the voices array is compacted.
+#define CUT_BITS 6
+#define CUT_BUCKETS (1 << CUT_BITS)
+static int cut_head[CUT_BUCKETS];
+static int cut_tail[CUT_BUCKETS];
+static int cut_next[MAX_SOUNDS];
+
 float starttime = 0;
 
+// maps periods of the audio device to wall clock time
+static audioclock_t *audio_clock = NULL;
+
+// sets the limit on how many sounds play at once
+static governor_t *governor = NULL;
+
+// sounds rendered before, NULL if it's off
+static rendercache_t *render_cache = NULL;
+static size_t render_cache_budget = 0;
+
+// renders sounds for the cache, on their own thread so they don't hold
+// up samples being loaded
+static thpool_t *render_cache_pool = NULL;
+
+// renders the first frames of sounds while they wait, NULL if it's off
+static thpool_t *prerender_pool = NULL;
+static int prerender_frames = 0;
+
 #ifdef JACK
 jack_client_t *jack_client = NULL;
 #endif
-float compression_speed = -1;
-
-float delay_time = 0.1;
-float delay_feedback = 0.7;
+// dynamics of the master bus
+static t_dynamics master_dynamics;
 
 bool use_dirty_compressor = false;
 bool use_late_trigger = false;
@@ -71,14 +150,31 @@ thpool_t* read_file_pool;
 
 const char* sampleroot;
 
-void queue_add(t_sound **queue, t_sound *new);
 void init_sound(t_sound *sound);
-int queue_size(t_sound *queue);
 
 #ifdef SEND_RMS
 static t_rms rms[MAX_ORBIT*2];
+// length of the meters' window in frames, zero until their rings are
+// allocated, and where the next frame goes in each ring
+static int rms_window = 0;
+static int rms_point = 0;
+// levels published by the audio thread for the sender, guarded by a
+// sequence count that is odd while they're being written
+static float rms_levels[MAX_ORBIT*2];
+static unsigned int rms_seq = 0;
 #endif
 
+// Sounds are mixed into a bus per rendering thread, the audio thread's
+// first, which are then summed. Each bus is split by orbit, so every
+// orbit's effects run once over all of its sounds.
+static t_bus *buses = NULL;
+static renderpool_t *render_pool = NULL;
+
+// what the render threads are working on
+static int render_playing[MAX_SOUNDS];
+static int render_frames;
+static unsigned int render_block = 0;
+
 static int is_sample_loading(const char* samplename) {
   int result = 0;
   t_sound *p = loading;
@@ -130,12 +226,11 @@ static void unmark_as_loading(const char* samplename, t_sample *sample) {
       if (sample) {
 	p->sample = sample;
 	init_sound(p);
-	pthread_mutex_lock(&queue_waiting_lock);
-	queue_add(&waiting, p);
-	pthread_mutex_unlock(&queue_waiting_lock);
+	mpsc_push(incoming, p);
       }
       else {
 	p->active = 0;
+	free_sound(p);
       }
     }
     p = next;
@@ -152,83 +247,59 @@ void *read_file_func(void* new) {
   return NULL;
 }
 
-int queue_size(t_sound *queue) {
-  int result = 0;
-  while (queue != NULL) {
-    result++;
-    queue = queue->next;
-    if (result > 4096) {
-      printf("whoops, big queue %d\n", result);
-      break;
-    }
-  }
-  return(result);
+static int waiting_before(const t_waiting *a, const t_waiting *b) {
+  return a->startT < b->startT
+    || (a->startT == b->startT && (int) (a->seq - b->seq) < 0);
 }
 
-void queue_add(t_sound **queue, t_sound *new) {
-  int added = 0;
-  assert(new->next != new);
-  assert(new->prev != new);
-  if (*queue == NULL) {
-    *queue = new;
-    added++;
-  }
-  else {
-    t_sound *tmp = *queue;
-    assert(tmp->prev == NULL);
-
-    int i =0;
-    while (1) {
-      if (tmp->startT > new->startT) {
-        // insert in front of later event
-        new->next = tmp;
-        new->prev = tmp->prev;
-        if (new->prev != NULL) {
-          new->prev->next = new;
-        }
-        else {
-          *queue = new;
-        }
-        tmp->prev = new;
+static void waiting_add(t_sound *sound) {
+  int i = waiting_n++;
+  t_waiting new = { sound->startT, waiting_seq++, sound };
 
-        added++;
-        break;
-      }
+  assert(waiting_n <= MAX_SOUNDS);
 
-      if (tmp->next == NULL) {
-        // add to end of queue
-        tmp->next = new;
-        new->prev = tmp;
-        added++;
-        break;
-      }
-      ++i;
-      tmp = tmp->next;
+  // sift up
+  while (i > 0) {
+    int parent = (i - 1) / 2;
+    if (!waiting_before(&new, &waiting[parent])) {
+      break;
     }
+    waiting[i] = waiting[parent];
+    i = parent;
   }
-
-  assert(added == 1);
+  waiting[i] = new;
 }
 
+// Removes and returns the first waiting sound if it's due by now
+static t_sound *waiting_next(sampletime_t now) {
+  t_sound *result;
+  t_waiting last;
+  int i = 0;
 
-void queue_remove(t_sound **queue, t_sound *old) {
-  // printf("played %d\n", old->played);
-  if (old->prev == NULL) {
-    *queue = old->next;
-    if (*queue  != NULL) {
-      (*queue)->prev = NULL;
-    }
+  if (waiting_n == 0 || waiting[0].startT > now) {
+    return(NULL);
   }
-  else {
-    old->prev->next = old->next;
+  result = waiting[0].sound;
 
-    if (old->next) {
-      old->next->prev = old->prev;
+  // sift the last entry down from the top
+  last = waiting[--waiting_n];
+  while (1) {
+    int child = 2 * i + 1;
+    if (child >= waiting_n) {
+      break;
     }
+    if (child + 1 < waiting_n && waiting_before(&waiting[child + 1], &waiting[child])) {
+      child++;
+    }
+    if (!waiting_before(&waiting[child], &last)) {
+      break;
+    }
+    waiting[i] = waiting[child];
+    i = child;
   }
-  old->active = 0;
-  old->is_playing = 0;
-  playing_n--;
+  waiting[i] = last;
+
+  return(result);
 }
 
 const double coeff[5][11]= {
@@ -254,96 +325,31 @@ const double coeff[5][11]= {
   }
 };
 
-float formant_filter(float in, t_sound *sound, int channel) {
-  float res =
-    (float) ( coeff[sound->formant_vowelnum][0] * in +
-              coeff[sound->formant_vowelnum][1] * sound->formant_history[channel][0] +
-              coeff[sound->formant_vowelnum][2] * sound->formant_history[channel][1] +
-              coeff[sound->formant_vowelnum][3] * sound->formant_history[channel][2] +
-              coeff[sound->formant_vowelnum][4] * sound->formant_history[channel][3] +
-              coeff[sound->formant_vowelnum][5] * sound->formant_history[channel][4] +
-              coeff[sound->formant_vowelnum][6] * sound->formant_history[channel][5] +
-              coeff[sound->formant_vowelnum][7] * sound->formant_history[channel][6] +
-              coeff[sound->formant_vowelnum][8] * sound->formant_history[channel][7] +
-              coeff[sound->formant_vowelnum][9] * sound->formant_history[channel][8] +
-              coeff[sound->formant_vowelnum][10] * sound->formant_history[channel][9]
-             );
-
-  sound->formant_history[channel][9] = sound->formant_history[channel][8];
-  sound->formant_history[channel][8] = sound->formant_history[channel][7];
-  sound->formant_history[channel][7] = sound->formant_history[channel][6];
-  sound->formant_history[channel][6] = sound->formant_history[channel][5];
-  sound->formant_history[channel][5] = sound->formant_history[channel][4];
-  sound->formant_history[channel][4] = sound->formant_history[channel][3];
-  sound->formant_history[channel][3] = sound->formant_history[channel][2];
-  sound->formant_history[channel][2] = sound->formant_history[channel][1];
-  sound->formant_history[channel][1] = sound->formant_history[channel][0];
-  sound->formant_history[channel][0] = (float) res;
-  return res;
-}
-
-void init_formant_history (t_sound *sound) {
-  // If uninitialized, create arrays
-  // TODO alloc - initialise at startup ?
-  if (!sound->formant_history) {
-    bool failed = false;
-
-    sound->formant_history = malloc(g_num_channels * sizeof(double*));
-    if (!sound->formant_history) failed = true;
-
-    for (int c = 0; c < g_num_channels; c++) {
-      sound->formant_history[c] = malloc(10 * sizeof(double));
-      if (!sound->formant_history[c]) failed = true;
-    }
-
-    if (failed) {
-      fprintf(stderr, "no memory to allocate `formant_history' array\n");
-      exit(1);
-    }
-  }
-
-  // Clean history for each channel
-  for (int c = 0; c < g_num_channels; c++) {
-    memset(sound->formant_history[c], 0, 10 * sizeof(double));
-  }
-}
-
-void free_formant_history (t_sound *sound) {
-  if (sound->formant_history) {
-    for (int c = 0; c < g_num_channels; c++) {
-      double* fh = sound->formant_history[c];
-      if (fh) free(fh);
-    }
-    free(sound->formant_history);
-  }
-  sound->formant_history = NULL;
-}
-
 void init_crs(t_sound *sound) {
   // TODO alloc - init at startup ?
-  if (!sound->coarsef) {
-    sound->coarsef = malloc(g_num_channels * sizeof(t_crs));
-    if (!sound->coarsef) {
+  if (!sound->voice.coarsef) {
+    sound->voice.coarsef = malloc(g_num_channels * sizeof(t_crs));
+    if (!sound->voice.coarsef) {
       fprintf(stderr, "no memory to allocate crs struct\n");
       exit(1);
     }
   }
-  memset(sound->coarsef, 0, g_num_channels * sizeof(t_crs));
+  memset(sound->voice.coarsef, 0, g_num_channels * sizeof(t_crs));
 }
 
 void init_vcf (t_sound *sound) {
-  if (!sound->vcf) {
-    sound->vcf = malloc(g_num_channels * sizeof(t_vcf));
-    if (!sound->vcf) {
+  if (!sound->voice.vcf) {
+    sound->voice.vcf = malloc(g_num_channels * sizeof(t_vcf));
+    if (!sound->voice.vcf) {
       fprintf(stderr, "no memory to allocate vcf struct\n");
       exit(1);
     }
   }
 
-  memset(sound->vcf, 0, g_num_channels * sizeof(t_vcf));
+  memset(sound->voice.vcf, 0, g_num_channels * sizeof(t_vcf));
 
   for (int channel = 0; channel < g_num_channels; ++channel) {
-    t_vcf *vcf = &(sound->vcf[channel]);
+    t_vcf *vcf = &(sound->voice.vcf[channel]);
     vcf->f     = 2 * sound->cutoff;
     vcf->k     = 3.6f * vcf->f - 1.6f * vcf->f * vcf->f -1;
     vcf->p     = (vcf->k+1) * 0.5f;
@@ -361,16 +367,16 @@ void init_vcf (t_sound *sound) {
 }
 
 void init_hpf (t_sound *sound) {
-  if (!sound->hpf) {
-    sound->hpf = malloc(g_num_channels * sizeof(t_vcf));
-    if (!sound->hpf) {
+  if (!sound->voice.hpf) {
+    sound->voice.hpf = malloc(g_num_channels * sizeof(t_vcf));
+    if (!sound->voice.hpf) {
       fprintf(stderr, "no memory to allocate hpf struct\n");
       exit(1);
     }
   }
 
   for (int channel = 0; channel < g_num_channels; ++channel) {
-    t_vcf *vcf = &(sound->hpf[channel]);
+    t_vcf *vcf = &(sound->voice.hpf[channel]);
     vcf->f     = 2 * sound->hcutoff;
     vcf->k     = 3.6f * vcf->f - 1.6f * vcf->f * vcf->f -1;
     vcf->p     = (vcf->k+1) * 0.5f;
@@ -388,9 +394,9 @@ void init_hpf (t_sound *sound) {
 }
 
 void init_bpf (t_sound *sound) {
-  if (!sound->bpf) {
-    sound->bpf = malloc(g_num_channels * sizeof(t_vcf));
-    if (!sound->bpf) {
+  if (!sound->voice.bpf) {
+    sound->voice.bpf = malloc(g_num_channels * sizeof(t_vcf));
+    if (!sound->voice.bpf) {
       fprintf(stderr, "no memory to allocate bpf struct\n");
       exit(1);
     }
@@ -398,7 +404,7 @@ void init_bpf (t_sound *sound) {
 
   // I've changed the meaning of some of these a bit
   for (int channel = 0; channel < g_num_channels; ++channel) {
-    t_vcf *vcf = &(sound->bpf[channel]);
+    t_vcf *vcf = &(sound->voice.bpf[channel]);
     vcf->f     = fabsf(sound->bandf);
     vcf->r     = sound->bandq;
     vcf->k     = vcf->f / vcf->r;
@@ -415,31 +421,35 @@ void init_bpf (t_sound *sound) {
   }
 }
 
+void free_crs (t_sound *sound) {
+  if (sound->voice.coarsef) free(sound->voice.coarsef);
+}
+
 void free_vcf (t_sound *sound) {
-  if (sound->vcf) free(sound->vcf);
+  if (sound->voice.vcf) free(sound->voice.vcf);
 }
 
 void free_hpf (t_sound *sound) {
-  if (sound->hpf) free(sound->hpf);
+  if (sound->voice.hpf) free(sound->voice.hpf);
 }
 
 void free_bpf (t_sound *sound) {
-  if (sound->bpf) free(sound->bpf);
+  if (sound->voice.bpf) free(sound->voice.bpf);
 }
 
-float effect_coarse(float in, t_sound *sound, int channel) {
-  t_crs *crs = &(sound->coarsef[channel]);
+float effect_coarse(float in, t_voice *voice, int channel) {
+  t_crs *crs = &(voice->coarsef[channel]);
 
   (crs->index)++;
-  if (sound->coarse > 0) {
-    if (crs->index == sound->coarse) {
+  if (voice->coarse > 0) {
+    if (crs->index == voice->coarse) {
       crs->index = 0;
       crs->last = in;
     }
   }
-  if (sound->coarse < 0) {
-    crs->sum += in / (float) -(sound->coarse);
-    if (crs->index == -(sound->coarse)) {
+  if (voice->coarse < 0) {
+    crs->sum += in / (float) -(voice->coarse);
+    if (crs->index == -(voice->coarse)) {
       crs->last = crs->sum;
       crs->index = 0;
       crs->sum = 0;
@@ -466,8 +476,8 @@ float fastPow(float a, float b) {
 #define myPow (float) powf
 #endif
 
-float effect_vcf(float in, t_sound *sound, int channel) {
-  t_vcf *vcf = &(sound->vcf[channel]);
+float effect_vcf(float in, t_voice *voice, int channel) {
+  t_vcf *vcf = &(voice->vcf[channel]);
   vcf->x  = in - vcf->r * vcf->y4;
 
   float xp = vcf->x * vcf->p;
@@ -490,8 +500,8 @@ float effect_vcf(float in, t_sound *sound, int channel) {
   return vcf->y4;
 }
 
-float effect_hpf(float in, t_sound *sound, int channel) {
-  t_vcf *vcf = &(sound->hpf[channel]);
+float effect_hpf(float in, t_voice *voice, int channel) {
+  t_vcf *vcf = &(voice->hpf[channel]);
   vcf->x  = in - vcf->r * vcf->y4;
 
   vcf->y1 = vcf->x  * vcf->p + vcf->oldx  * vcf->p - vcf->k * vcf->y1;
@@ -509,8 +519,8 @@ float effect_hpf(float in, t_sound *sound, int channel) {
   return (in - vcf->y4);
 }
 
-float effect_bpf(float in, t_sound *sound, int channel) {
-  t_vcf *vcf = &(sound->bpf[channel]);
+float effect_bpf(float in, t_voice *voice, int channel) {
+  t_vcf *vcf = &(voice->bpf[channel]);
   vcf->x  = in;
 
   vcf->y3 = vcf->p * vcf->y2 - vcf->y1 + vcf->k * (vcf->x - vcf->oldx +
@@ -525,22 +535,272 @@ float effect_bpf(float in, t_sound *sound, int channel) {
 
 /**/
 
-/**/
+// Block versions of the effects, for compile_effects() to chain up
+
+// The formant filter's history is a circular buffer, newest first
+// from point, so each output is one pass over contiguous taps rather
+// than shifting the history along every frame. The filter is very
+// sensitive to rounding, so it's worked out in double precision.
+
+static void block_formant(float *buf, int n, t_voice *voice, int channel) {
+  const double *c = coeff[voice->formant_vowelnum];
+  t_formant *formant = &voice->formant[channel];
+  double *history = formant->history;
+  int point = formant->point;
+
+  for (int i = 0; i < n; ++i) {
+    const double *y = history + point;
+    float res =
+      (float) ( c[0] * buf[i] +
+                c[1] * y[0] + c[2] * y[1] + c[3] * y[2] + c[4] * y[3] +
+                c[5] * y[4] + c[6] * y[5] + c[7] * y[6] + c[8] * y[7] +
+                c[9] * y[8] + c[10] * y[9]
+               );
+
+    point = (point == 0) ? FORMANT_TAPS - 1 : point - 1;
+    history[point] = history[point + FORMANT_TAPS] = res;
+    buf[i] = res;
+  }
+  formant->point = point;
+}
 
-void add_delay(t_line *line, float sample, float delay, float feedback) {
-  int point = (line->point + (int) ( delay * MAXLINE )) % MAXLINE;
+// As a filter's input goes quiet its state decays towards zero, and
+// would end up in subnormal numbers, which are very slow to work with
+// on some CPUs. Values this small are inaudible, so they're flushed
+// to zero after each block.
 
-  //printf("'feedback': %f\n", feedback);
-  line->samples[point] += (sample * feedback);
+#define FLUSH_BELOW 1e-15f
+
+static inline float flush(float value) {
+  return (fabsf(value) < FLUSH_BELOW) ? 0 : value;
 }
 
-/**/
+static void flush_vcf(t_vcf *vcf) {
+  vcf->x     = flush(vcf->x);
+  vcf->y1    = flush(vcf->y1);
+  vcf->y2    = flush(vcf->y2);
+  vcf->y3    = flush(vcf->y3);
+  vcf->y4    = flush(vcf->y4);
+  vcf->oldx  = flush(vcf->oldx);
+  vcf->oldy1 = flush(vcf->oldy1);
+  vcf->oldy2 = flush(vcf->oldy2);
+  vcf->oldy3 = flush(vcf->oldy3);
+}
 
-float shift_delay(t_line *line) {
-  float result = line->samples[line->point];
-  line->samples[line->point] = 0;
-  line->point = (line->point + 1) % MAXLINE;
-  return(result);
+static void block_vcf(float *buf, int n, t_voice *voice, int channel) {
+  for (int i = 0; i < n; ++i) {
+    buf[i] = effect_vcf(buf[i], voice, channel);
+  }
+  flush_vcf(&voice->vcf[channel]);
+}
+
+static void block_hpf(float *buf, int n, t_voice *voice, int channel) {
+  for (int i = 0; i < n; ++i) {
+    buf[i] = effect_hpf(buf[i], voice, channel);
+  }
+  flush_vcf(&voice->hpf[channel]);
+}
+
+static void block_bpf(float *buf, int n, t_voice *voice, int channel) {
+  for (int i = 0; i < n; ++i) {
+    buf[i] = effect_bpf(buf[i], voice, channel);
+  }
+  flush_vcf(&voice->bpf[channel]);
+}
+
+// negative bandf notches out the band instead
+static void block_notch(float *buf, int n, t_voice *voice, int channel) {
+  for (int i = 0; i < n; ++i) {
+    buf[i] = buf[i] - effect_bpf(buf[i], voice, channel);
+  }
+  flush_vcf(&voice->bpf[channel]);
+}
+
+static void block_coarse(float *buf, int n, t_voice *voice, int channel) {
+  for (int i = 0; i < n; ++i) {
+    buf[i] = effect_coarse(buf[i], voice, channel);
+  }
+}
+
+static void block_shape(float *buf, int n, t_voice *voice, int channel) {
+  float k = voice->shape_k;
+  for (int i = 0; i < n; ++i) {
+    buf[i] = (1+k)*buf[i]/(1+k*(float) fabs(buf[i]));
+  }
+}
+
+// with gain compensation, fine-tuned by ear
+static void block_shape_comp(float *buf, int n, t_voice *voice, int channel) {
+  float k = voice->shape_k;
+  float gcomp = 1.0f - (0.15f * k / (k + 2.0f));
+  for (int i = 0; i < n; ++i) {
+    float value = (1+k)*buf[i]/(1+k*(float) fabs(buf[i]));
+    buf[i] = value * (gcomp * gcomp);
+  }
+}
+
+static void block_crush(float *buf, int n, t_voice *voice, int channel) {
+  float scale = voice->crush_scale;
+  for (int i = 0; i < n; ++i) {
+    //value = (1.0 + log(fabs(value)) / 16.63553) * (value / fabs(value));
+    buf[i] = (float) truncf(scale * buf[i]) / scale;
+    //value = exp( (fabs(value) - 1.0) * 16.63553 ) * (value / fabs(value));
+  }
+}
+
+// negative crush crushes on a log scale. x^0.125 and x^8 are done
+// with square roots and squaring rather than pow()
+static void block_logcrush(float *buf, int n, t_voice *voice, int channel) {
+  float scale = voice->crush_scale;
+  for (int i = 0; i < n; ++i) {
+    float value = buf[i];
+    int isgn = (value >= 0) ? 1 : -1;
+    value = sqrtf(sqrtf(sqrtf(fabsf(value))));
+    value = (float) truncf(scale * value) / scale;
+    value *= value;
+    value *= value;
+    buf[i] = isgn * value * value;
+  }
+}
+
+// Works out which effects a sound uses, and chains them up in the
+// order they're applied, so that playback only runs those.
+
+static void compile_effects(t_sound *sound) {
+  int n = 0;
+
+  if (sound->formant_vowelnum >= 0) {
+    sound->voice.effects[n++] = block_formant;
+  }
+
+  // why 44000 (or 44100)? init_vcf divides by samplerate..
+  if (sound->resonance > 0 && sound->resonance < 1
+      && sound->cutoff > 0 && sound->cutoff < 1) {
+    sound->voice.effects[n++] = block_vcf;
+  }
+  if (sound->hresonance > 0 && sound->hresonance < 1
+      && sound->hcutoff > 0 && sound->hcutoff < 1) {
+    sound->voice.effects[n++] = block_hpf;
+  }
+  if (sound->bandf > 0 && sound->bandf < 1 && sound->bandq > 0) {
+    sound->voice.effects[n++] = block_bpf;
+  } else if (sound->bandf < 0 && sound->bandf > -1 && sound->bandq > 0) {
+    sound->voice.effects[n++] = block_notch;
+  }
+
+  if (sound->coarse != 0) {
+    sound->voice.effects[n++] = block_coarse;
+  }
+
+  if (sound->shape) {
+    sound->voice.effects[n++] = use_shape_gain_comp ? block_shape_comp : block_shape;
+  }
+
+  if (sound->crush > 0) {
+    sound->voice.effects[n++] = block_crush;
+  } else if (sound->crush < 0) {
+    sound->voice.effects[n++] = block_logcrush;
+  }
+
+  assert(n <= MAX_EFFECTS);
+  sound->voice.effects_n = n;
+}
+
+// Gives a delay its lines, the first time a sound sends to it. This
+// is called from the OSC and file loading threads, and only one of them
+// gets to put its lines in place. The lines are long enough for a
+// second of delay at the current sample rate.
+
+static void init_delay(t_delay *delay) {
+  t_lines *lines, *expected = NULL;
+  unsigned int size = 1;
+
+  if (__atomic_load_n(&delay->lines, __ATOMIC_ACQUIRE) != NULL) {
+    return;
+  }
+
+  while (size < (unsigned int) g_samplerate + 2) {
+    size <<= 1;
+  }
+  lines = calloc(1, sizeof(t_lines) + (size_t) size * g_num_channels * sizeof(float));
+  if (!lines) {
+    fprintf(stderr, "no memory to allocate delay lines\n");
+    exit(1);
+  }
+  lines->mask = size - 1;
+
+  if (!__atomic_compare_exchange_n(&delay->lines, &expected, lines, false,
+                                   __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    free(lines);
+  }
+}
+
+// A delay's tail is over once its echoes have stayed below this level,
+// about -120 dB, for the length of its lines. It's fixed rather than
+// the silence threshold, which is usually off, as with feedback over a
+// half the echoes would otherwise decay into subnormals and never stop.
+
+#define DELAY_FLOOR 1e-6f
+
+// Runs a block through a delay, adding its output to out. sends
+// is what's going into it, or NULL if nothing is. A sound comes back
+// delaytime seconds after it's sent, and each echo feedback times as
+// loud one frame later than the last.
+
+static void run_delay(t_delay *delay, float sends[][MAX_BLOCK], float out[][MAX_BLOCK],
+                      int frames) {
+  t_lines *lines = __atomic_load_n(&delay->lines, __ATOMIC_ACQUIRE);
+  unsigned int time = (unsigned int) (delay->time * g_samplerate);
+  float feedback = delay->feedback;
+  unsigned int point = delay->point;
+  unsigned int mask;
+  float peak = 0;
+
+  if (lines == NULL) {
+    return;
+  }
+  mask = lines->mask;
+
+  for (int channel = 0; channel < g_num_channels; ++channel) {
+    float *line = lines->samples + (size_t) channel * (mask + 1);
+
+    point = delay->point;
+    for (int i = 0; i < frames; ++i) {
+      if (sends != NULL) {
+        line[(point + time) & mask] += sends[channel][i];
+      }
+
+      float tmp = line[point];
+      line[point] = 0;
+      point = (point + 1) & mask;
+      if (feedback > 0 && tmp != 0) {
+        line[(point + time) & mask] += flush(tmp * feedback);
+      }
+      out[channel][i] += tmp;
+      peak = (fabsf(tmp) > peak) ? fabsf(tmp) : peak;
+    }
+  }
+  delay->point = point;
+
+  if (sends != NULL || peak > DELAY_FLOOR) {
+    delay->quiet = 0;
+  }
+  else if (delay->quiet <= mask) {
+    delay->quiet += frames;
+    // Everything has come round at least once since, so whatever is
+    // left in the lines is too quiet to hear. It's cleared out so it
+    // can't come back when something's sent again.
+    if (delay->quiet > mask) {
+      memset(lines->samples, 0, sizeof(float) * (mask + 1) * g_num_channels);
+    }
+  }
+}
+
+// Whether a delay has echoes still to come
+
+static int delay_live(t_delay *delay) {
+  t_lines *lines = __atomic_load_n(&delay->lines, __ATOMIC_ACQUIRE);
+  return (lines != NULL && delay->quiet <= lines->mask);
 }
 
 /**/
@@ -556,9 +816,7 @@ extern int audio_play(t_sound* sound) {
     init_sound(sound);
     sound->prev = NULL;
     sound->next = NULL;
-    pthread_mutex_lock(&queue_waiting_lock);
-    queue_add(&waiting, sound);
-    pthread_mutex_unlock(&queue_waiting_lock);
+    mpsc_push(incoming, sound);
   }
   else {
     pthread_mutex_lock(&queue_loading_lock);
@@ -575,22 +833,460 @@ extern int audio_play(t_sound* sound) {
 
 }
 
+// Works out how many frames the next stage of a sound's envelope
+// lasts, and where its curve starts. Stage boundaries are the same as
+// for an envelope worked out from the time since the sound started:
+// attack while t < attack, hold until t > attack + hold, release until
+// t > attack + hold + release.
+
+static void envelope_stage(t_voice *voice, int stage) {
+  double sr = g_samplerate;
+  double attack_end = ceil(voice->attack * sr);
+  double hold_end = floor((voice->attack + voice->hold) * sr) + 1;
+  double release_end = floor((voice->attack + voice->hold + voice->release) * sr) + 1;
+  double frames = 0;
+
+  if (hold_end < attack_end) {
+    hold_end = attack_end;
+  }
+  if (release_end < hold_end) {
+    release_end = hold_end;
+  }
+
+  switch (stage) {
+  case ENV_ATTACK:
+    frames = attack_end;
+    voice->env_exp = 1;
+    voice->env_mul = exp(-3.0 / (voice->attack * sr));
+    break;
+  case ENV_HOLD:
+    frames = hold_end - attack_end;
+    break;
+  case ENV_RELEASE:
+    frames = release_end - hold_end;
+    if (frames > 0) {
+      voice->env_exp = exp(-3.0 * (hold_end / sr - voice->attack - voice->hold) / voice->release);
+      voice->env_mul = exp(-3.0 / (voice->release * sr));
+    }
+    break;
+  }
+
+  voice->env_stage = stage;
+  voice->env_frames = (frames > INT_MAX) ? INT_MAX : (int) frames;
+
+  // skip over empty stages
+  if (stage != ENV_DONE && voice->env_frames == 0) {
+    envelope_stage(voice, stage + 1);
+  }
+}
+
+// Multiplies n values in amp by the next n values of a sound's
+// envelope. The exponential curves are worked out recursively, one
+// multiply per frame.
+
+static void envelope(t_voice *voice, float *amp, int n) {
+  int i = 0;
+
+  while (i < n) {
+    int m = n - i;
+
+    if (voice->env_stage == ENV_DONE) {
+      memset(amp + i, 0, sizeof(float) * m);
+      break;
+    }
+    if (m > voice->env_frames) {
+      m = voice->env_frames;
+    }
+
+    switch (voice->env_stage) {
+    case ENV_ATTACK:
+      for (int j = i; j < i + m; ++j) {
+        amp[j] *= (float) (1.0523957 - 1.0523958 * voice->env_exp);
+        voice->env_exp *= voice->env_mul;
+      }
+      break;
+    case ENV_RELEASE:
+      for (int j = i; j < i + m; ++j) {
+        amp[j] *= (float) (1.0523957 * voice->env_exp - 0.0523957);
+        voice->env_exp *= voice->env_mul;
+      }
+      break;
+    }
+
+    i += m;
+    voice->env_frames -= m;
+    if (voice->env_frames == 0) {
+      envelope_stage(voice, voice->env_stage + 1);
+    }
+  }
+}
+
+// Works out the output channels and equal power panning gains for
+// each channel of a sound. The pan doesn't change while the sound
+// plays, so this only needs doing once.
+
+static void init_pan(t_sound *sound, float pan_pos) {
+  t_voice *voice = &sound->voice;
+
+  for (int channel = 0; channel < (voice->mono ? 1 : voice->channels); ++channel) {
+    t_pan *pan = &voice->pans[channel];
+    float c = (float) channel + pan_pos;
+    float d = c - (float) floor(c);
+
+    pan->channel_a =  ((int) c) % g_num_channels;
+    pan->channel_b =  ((int) c + 1) % g_num_channels;
+
+    if (pan->channel_a < 0) {
+      pan->channel_a += g_num_channels;
+    }
+    if (pan->channel_b < 0) {
+      pan->channel_b += g_num_channels;
+    }
+
+    // shortcuts for middle, hard left + hard right
+    if (d == 0.5f) {
+      pan->gain_a = pan->gain_b = 0.7071067811f;
+    }
+    else if (d == 0) {
+      pan->gain_a = 1;
+      pan->gain_b = 0;
+    }
+    else if (d == 1) {
+      pan->gain_a = 0;
+      pan->gain_b = 1;
+    }
+    else {
+      pan->gain_a = (float) cos(HALF_PI * d);
+      pan->gain_b = (float) sin(HALF_PI * d);
+    }
+  }
+}
+
+// Everything that decides what a sound's channels are like before
+// gain, envelope and panning, which is what the render cache keeps
+
+typedef struct {
+  t_sample *sample;
+  float start;
+  float end;
+  float speed;
+  int   reverse;
+  int   mono;
+  int   interpolation;
+  int   effects_n;
+  t_effect effects[MAX_EFFECTS];
+  int   formant_vowelnum;
+  float cutoff;
+  float resonance;
+  float hcutoff;
+  float hresonance;
+  float bandf;
+  float bandq;
+  int   coarse;
+  float shape_k;
+  float crush_scale;
+} t_render_key;
+
+// A sound to render into the cache, with its own copy of the effect
+// state so it doesn't get in the way of the sound playing
+
+typedef struct {
+  rendercache_entry_t *entry;
+  t_voice voice;
+  t_vcf vcf[MAX_CHANNELS];
+  t_vcf hpf[MAX_CHANNELS];
+  t_vcf bpf[MAX_CHANNELS];
+  t_crs coarsef[MAX_CHANNELS];
+  t_formant formant[2];
+} t_cache_job;
+
+static int step_voice(t_voice *p, int *index, int *next, float *tween, float *amp,
+                      int frames, int *playing);
+static void render_channel(t_voice *p, float *buf, int channel, const int *index,
+                           const int *next, const float *tween, int n);
+
+// Renders up to frames frames of each channel of a sound, away from
+// the audio thread, moving the sound on. Channels are stride values
+// apart in samples. Returns how many frames were rendered, fewer if
+// the sound ended, when playing is cleared.
+
+static int render_ahead(t_voice *p, float *samples, int stride, int frames, int *playing) {
+  int channels = p->mono ? 1 : p->channels;
+  int index[MAX_BLOCK];
+  int next[MAX_BLOCK];
+  float tween[MAX_BLOCK];
+  float amp[MAX_BLOCK];
+  int done = 0;
+
+  while (done < frames && *playing) {
+    int n = frames - done;
+
+    n = step_voice(p, index, next, tween, amp, (n > MAX_BLOCK) ? MAX_BLOCK : n, playing);
+    for (int channel = 0; channel < channels; ++channel) {
+      render_channel(p, samples + channel * stride + done, channel,
+                     index, next, tween, n);
+    }
+    done += n;
+  }
+  return(done);
+}
+
+// Renders a sound for the cache, from start to end, on a worker
+// thread. If it turns out longer than it was expected to be, it's
+// given up on.
+
+static void *render_cached(void *arg) {
+  t_cache_job *job = arg;
+  t_voice *p = &job->voice;
+  int channels = p->mono ? 1 : p->channels;
+  int capacity = (int) ((p->end - p->start) / p->speed) + MAX_BLOCK;
+  float *samples = malloc(sizeof(float) * channels * capacity);
+  int playing = 1;
+  int frames = 0;
+
+  if (samples != NULL) {
+    frames = render_ahead(p, samples, capacity, capacity, &playing);
+    if (playing) {
+      free(samples);
+      samples = NULL;
+    }
+  }
+
+  // close the channels up to their actual length
+  if (samples != NULL) {
+    for (int channel = 1; channel < channels; ++channel) {
+      memmove(samples + channel * frames, samples + channel * capacity,
+              sizeof(float) * frames);
+    }
+  }
+
+  rendercache_fill(render_cache, job->entry, samples, channels, frames);
+  rendercache_release(render_cache, job->entry);
+  free(job);
+  return NULL;
+}
+
+// Looks a sound up in the render cache, if it's on. A sound that's
+// been rendered before plays its channels from there, and the first
+// time one turns up it's rendered on a worker thread for next time.
+// Sounds that change speed or loop aren't cached, and nor are those
+// too long to be worth the memory.
+
+static void cache_sound(t_sound *sound) {
+  t_voice *voice = &sound->voice;
+  int channels = voice->mono ? 1 : voice->channels;
+  rendercache_entry_t *entry;
+  t_render_key key;
+  bool added;
+
+  voice->cache = NULL;
+  voice->played = 0;
+
+  if (render_cache == NULL || voice->accelerate != 0 || voice->sample_loop > 1
+      || voice->cut_continue || voice->speed <= 0) {
+    return;
+  }
+  if (((voice->end - voice->start) / voice->speed + MAX_BLOCK) * channels * sizeof(float)
+      > render_cache_budget / 4) {
+    return;
+  }
+
+  // zeroed first, so the padding compares equal too
+  memset(&key, 0, sizeof(key));
+  key.sample = voice->sample;
+  key.start = voice->start;
+  key.end = voice->end;
+  key.speed = voice->speed;
+  key.reverse = voice->reverse;
+  key.mono = voice->mono;
+  key.interpolation = voice->interpolation;
+  key.effects_n = voice->effects_n;
+  memcpy(key.effects, voice->effects, sizeof(t_effect) * voice->effects_n);
+  key.formant_vowelnum = voice->formant_vowelnum;
+  key.cutoff = sound->cutoff;
+  key.resonance = sound->resonance;
+  key.hcutoff = sound->hcutoff;
+  key.hresonance = sound->hresonance;
+  key.bandf = sound->bandf;
+  key.bandq = sound->bandq;
+  key.coarse = voice->coarse;
+  key.shape_k = voice->shape_k;
+  key.crush_scale = voice->crush_scale;
+
+  entry = rendercache_get(render_cache, &key, sizeof(key), &added);
+  if (entry == NULL) {
+    return;
+  }
+
+  if (added) {
+    t_cache_job *job = malloc(sizeof(t_cache_job));
+    if (job != NULL) {
+      job->entry = entry;
+      job->voice = *voice;
+      memcpy(job->vcf, voice->vcf, sizeof(t_vcf) * g_num_channels);
+      memcpy(job->hpf, voice->hpf, sizeof(t_vcf) * g_num_channels);
+      memcpy(job->bpf, voice->bpf, sizeof(t_vcf) * g_num_channels);
+      memcpy(job->coarsef, voice->coarsef, sizeof(t_crs) * g_num_channels);
+      memcpy(job->formant, sound->formant, sizeof(job->formant));
+      job->voice.vcf = job->vcf;
+      job->voice.hpf = job->hpf;
+      job->voice.bpf = job->bpf;
+      job->voice.coarsef = job->coarsef;
+      job->voice.formant = job->formant;
+      if (thpool_add_job(render_cache_pool, render_cached, job)) {
+        return;
+      }
+      free(job);
+    }
+    fprintf(stderr, "cache_sound: could not add rendering job for '%s'\n", sound->samplename);
+    rendercache_fill(render_cache, entry, NULL, 0, 0);
+    rendercache_release(render_cache, entry);
+  }
+  else if (rendercache_ready(entry)) {
+    voice->cache = entry;
+  }
+  else {
+    // still being rendered, or it failed, so this one's rendered as
+    // it plays
+    rendercache_release(render_cache, entry);
+  }
+}
+
+// Pre-rendering works on a copy of a sound's render state, so the
+// audio thread can start it from scratch instead if it's due before the
+// worker's done. Whoever gives up on it hands it back:
+//
+// PRE_FREE      -> PRE_QUEUED    init_sound() queues it up
+// PRE_QUEUED    -> PRE_RUNNING   a worker starts on it
+// PRE_RUNNING   -> PRE_READY     the worker's done, the audio thread
+//                                hands it back once it's played it
+// PRE_QUEUED or
+// PRE_RUNNING   -> PRE_ABANDONED the sound started first, the worker
+//                                hands it back once it notices
+
+enum {
+  PRE_FREE,
+  PRE_QUEUED,
+  PRE_RUNNING,
+  PRE_READY,
+  PRE_ABANDONED
+};
+
+// The first frames of a sound, rendered ahead on a worker, with the
+// effect state they leave behind for the rest to carry on from. Only
+// stereo sounds render two channels.
+
+typedef struct t_prerender {
+  int state;
+  int frames;
+  float *samples; // the two channels, prerender_frames apart
+  t_voice voice;
+  t_vcf vcf[2];
+  t_vcf hpf[2];
+  t_vcf bpf[2];
+  t_crs coarsef[2];
+  t_formant formant[2];
+} t_prerender;
+
+static void *prerender_job(void *arg) {
+  t_prerender *pre = arg;
+  int state = PRE_QUEUED;
+  int playing = 1;
+
+  if (!__atomic_compare_exchange_n(&pre->state, &state, PRE_RUNNING, false,
+                                   __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+    __atomic_store_n(&pre->state, PRE_FREE, __ATOMIC_RELEASE);
+    return NULL;
+  }
+
+  pre->frames = render_ahead(&pre->voice, pre->samples, prerender_frames,
+                             prerender_frames, &playing);
+
+  state = PRE_RUNNING;
+  if (!__atomic_compare_exchange_n(&pre->state, &state, PRE_READY, false,
+                                   __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    __atomic_store_n(&pre->state, PRE_FREE, __ATOMIC_RELEASE);
+  }
+  return NULL;
+}
+
+// Queues up the first frames of a sound to be rendered ahead of time,
+// if that's on. Sounds played from the render cache don't need it, and
+// those that carry on from where a cut one left off can't know where
+// they start until they do.
+
+static void prerender_sound(t_sound *sound) {
+  t_voice *voice = &sound->voice;
+  t_prerender *pre = sound->prerender;
+  int channels = voice->mono ? 1 : voice->channels;
+
+  if (prerender_pool == NULL || voice->cache != NULL || voice->cut_continue) {
+    return;
+  }
+
+  if (pre == NULL) {
+    pre = calloc(1, sizeof(t_prerender));
+    if (pre) {
+      pre->samples = malloc(sizeof(float) * 2 * prerender_frames);
+    }
+    if (!pre || !pre->samples) {
+      fprintf(stderr, "no memory to allocate prerender struct\n");
+      exit(1);
+    }
+    sound->prerender = pre;
+  }
+  else if (__atomic_load_n(&pre->state, __ATOMIC_ACQUIRE) != PRE_FREE) {
+    // a worker's still to let go of it from the last time round
+    return;
+  }
+
+  pre->voice = *voice;
+  memcpy(pre->vcf, voice->vcf, sizeof(t_vcf) * channels);
+  memcpy(pre->hpf, voice->hpf, sizeof(t_vcf) * channels);
+  memcpy(pre->bpf, voice->bpf, sizeof(t_vcf) * channels);
+  memcpy(pre->coarsef, voice->coarsef, sizeof(t_crs) * channels);
+  memcpy(pre->formant, sound->formant, sizeof(pre->formant));
+  pre->voice.vcf = pre->vcf;
+  pre->voice.hpf = pre->hpf;
+  pre->voice.bpf = pre->bpf;
+  pre->voice.coarsef = pre->coarsef;
+  pre->voice.formant = pre->formant;
+  pre->frames = 0;
+
+  __atomic_store_n(&pre->state, PRE_QUEUED, __ATOMIC_RELEASE);
+  if (!thpool_add_job(prerender_pool, prerender_job, pre)) {
+    __atomic_store_n(&pre->state, PRE_FREE, __ATOMIC_RELEASE);
+  }
+}
+
+// Works out the render state of a sound from its parameters, ready for
+// it to start playing. The parameters themselves are left as they were
+// given.
+
 void init_sound(t_sound *sound) {
-  
+  t_voice *voice = &sound->voice;
   float start_pc = sound->start;
   float end_pc = sound->end;
+  float speed = sound->speed;
+  float accelerate = sound->accelerate;
+  float pan = sound->pan;
   t_sample *sample = sound->sample;
 
+  voice->sound = sound;
+  voice->sample = sample;
+
   // switch to frames not percent..
-  sound->start = 0;
-  sound->end = sample->info->frames;
-  sound->items = sample->items;
-  sound->channels = sample->info->channels;
+  voice->start = 0;
+  voice->end = sample->info->frames;
+  voice->frames = sample->info->frames;
+  voice->items = sample->items;
+  voice->channels = sample->info->channels;
 
   sound->active = 1;
 
-  if (sound->delay > 1) {
-    sound->delay = 1;
+  voice->delay = sound->delay;
+  if (voice->delay > 1) {
+    voice->delay = 1;
   }
 
   if (sound->delaytime > 1) {
@@ -601,44 +1297,51 @@ void init_sound(t_sound *sound) {
     sound->delayfeedback = 0.9999;
   }
 
-#ifdef JACK
-  sound->startT = (sound->when - epochOffset) * 1000000;
-# else
-  sound->startT = sound->when - epochOffset;
-#endif
-  
+  sound->startT = sound->when;
+  voice->startT = sound->startT;
+
+  // samples kept at their own rate (see --native-rate) go through more
+  // or fewer of their frames per second to sound right
+  float rate = (float) sample->info->samplerate / g_samplerate;
 
   if (sound->unit == 's') { // unit = "sec"
-    sound->accelerate = sound->accelerate / sound->speed; // change rate by 1 per specified duration
-    sound->speed = sound->sample->info->frames / sound->speed / g_samplerate;
+    accelerate = accelerate / speed; // change rate by 1 per specified duration
+    speed = sample->info->frames / speed / g_samplerate;
   }
   else if (sound->unit == 'c') { // unit = "cps"
-    sound->accelerate = sound->accelerate * sound->speed * sound->cps; // change rate by 1 per cycle
-    sound->speed = sound->sample->info->frames * sound->speed * sound->cps / g_samplerate;
+    accelerate = accelerate * speed * sound->cps; // change rate by 1 per cycle
+    speed = sample->info->frames * speed * sound->cps / g_samplerate;
   }
   // otherwise, unit is rate/ratio,
   // i.e. 2 = twice as fast, -1 = normal but backwards
+  else {
+    speed *= rate;
+  }
+  accelerate *= rate;
 
   sound->next = NULL;
   sound->prev = NULL;
-  sound->reverse  = sound->speed < 0;
-  sound->speed    = fabsf(sound->speed);
+  voice->reverse    = speed < 0;
+  voice->speed      = fabsf(speed);
+  voice->accelerate = accelerate;
 
-  if (sound->channels == 2 && g_num_channels == 2 && sound->pan == 0.5f) {
-    sound->pan = 0;
+  voice->mono = 0;
+  if (voice->channels == 2 && g_num_channels == 2 && pan == 0.5f) {
+    pan = 0;
   }
   else {
-    sound->mono = 1;
+    voice->mono = 1;
   }
 #ifdef FAKECHANNELS
-  sound->pan *= (float) g_num_channels / FAKECHANNELS;
+  pan *= (float) g_num_channels / FAKECHANNELS;
 #endif
 #ifdef SCALEPAN
   if (g_num_channels > 2) {
-    sound->pan *= (float) g_num_channels;
+    pan *= (float) g_num_channels;
   }
 #endif
-  init_formant_history(sound);
+  voice->formant_vowelnum = sound->formant_vowelnum;
+  voice->formant = sound->formant;
 
 //  if (sound->shape != 0) {
 //    float tmp = sound->shape;
@@ -649,32 +1352,32 @@ void init_sound(t_sound *sound) {
 //    sound->shape = 1;
 //    sound->shape_k = (2.0f * tmp) / (1.0f - tmp);
 //  }
-  
+  voice->shape_k = sound->shape_k;
+
   if (sound->crush != 0) {
     float tmp = sound->crush;
     sound->crush = (tmp > 0) ? 1 : -1;
     sound->crush_bits = fabsf(tmp);
+    voice->crush_scale = myPow(2, sound->crush_bits - 1);
   }
-  
+
+  voice->coarse = sound->coarse;
   init_crs(sound);
 
   if (start_pc < 0) {
     start_pc = 0;
-    sound->cut_continue = 1;
+    voice->cut_continue = 1;
   }
 
   init_vcf(sound);
   init_hpf(sound);
   init_bpf(sound);
 
-  if (sound->delaytime >= 0) {
-    delay_time = sound->delaytime;
-  }
-  if (sound->delayfeedback >= 0) {
-    delay_feedback = sound->delayfeedback;
+  if (voice->delay > 0) {
+    init_delay(&delays[sound->orbit]);
   }
 
-  if (sound->reverse) {
+  if (voice->reverse) {
     float tmp = start_pc;
     start_pc = 1 - end_pc;
     end_pc = 1 - tmp;
@@ -682,389 +1385,875 @@ void init_sound(t_sound *sound) {
 
   //printf("frames: %f\n", new->end);
   if (start_pc > 0 && start_pc <= 1) {
-    sound->start = start_pc * sound->end;
+    voice->start = start_pc * voice->end;
   }
 
   if (end_pc > 0 && end_pc < 1) {
-    sound->end *= end_pc;
+    voice->end *= end_pc;
+  }
+  voice->position = voice->start;
+  voice->given_end = voice->end;
+  voice->gain = sound->gain;
+  voice->sample_loop = sound->sample_loop;
+  voice->cutgroup = sound->cutgroup;
+  voice->orbit = sound->orbit;
+
+  voice->attack = sound->attack;
+  voice->hold = sound->hold;
+  voice->release = sound->release;
+  voice->audible = 0;
+  voice->quiet = 0;
+  voice->interpolation = (sound->interpolation >= 0 && sound->interpolation < INTERP_QUALITIES)
+    ? sound->interpolation : g_interpolation;
+  if (sound->attack >= 0 && sound->release >= 0) {
+    envelope_stage(voice, ENV_ATTACK);
+  }
+  else {
+    voice->env_stage = ENV_NONE;
   }
-  sound->position = sound->start;
-  sound->playtime = 0.0;
+
+  init_pan(sound, pan);
+  compile_effects(sound);
+  cache_sound(sound);
+  prerender_sound(sound);
 }
 
 
-t_sound *queue_next(t_sound **queue, sampletime_t now) {
-  t_sound *result = NULL;
-  // printf("queue_next - waiting sz %d / %d\n", queue_size(*queue), queue_size(waiting));
-  //printf("%f vs %f\n", *queue == NULL ? 0 : (*queue)->startT, now);
-  if (*queue != NULL && (*queue)->startT <= now) {
-    result = *queue;
-    *queue = (*queue)->next;
-    if ((*queue) != NULL) {
-      (*queue)->prev = NULL;
-    }
+// Where a playing voice will have got to the given number of frames
+// into the next block, roughly, as acceleration is left out
+
+static float position_at(t_voice *p, int frames) {
+  frames -= p->offset;
+  return (frames > 0) ? p->position + p->speed * frames : p->position;
+}
+
+// Cuts off the voices in the same cut group as a voice that's about to
+// start, from the frame it starts at
+
+static unsigned int cut_bucket(int group, t_sample *sample) {
+  uint32_t key = (uint32_t) group * 2654435761u;
+
+  if (group < 0) {
+    key ^= (uint32_t) ((uintptr_t) sample >> 4) * 2246822519u;
   }
-  return(result);
+  return key >> (32 - CUT_BITS);
 }
 
-void cut(t_sound *s) {
-  t_sound *p = NULL;
-  p = playing;
+static void cut_clear(void) {
+  for (int i = 0; i < CUT_BUCKETS; ++i) {
+    cut_head[i] = -1;
+  }
+}
+
+// Lists voice i in its cut group's bucket, after the others
+
+static void cut_add(int i) {
+  t_voice *p = &voices[i];
 
+  if (p->cutgroup != 0) {
+    unsigned int bucket = cut_bucket(p->cutgroup, p->sample);
+
+    cut_next[i] = -1;
+    if (cut_head[bucket] < 0) {
+      cut_head[bucket] = i;
+    }
+    else {
+      cut_next[cut_tail[bucket]] = i;
+    }
+    cut_tail[bucket] = i;
+  }
+}
+
+void cut(t_voice *s) {
   int group = s->cutgroup;
 
   if (group != 0) {
-    while (p != NULL) {
+    for (int i = cut_head[cut_bucket(group, s->sample)]; i >= 0; i = cut_next[i]) {
+      t_voice *p = &voices[i];
       // If group is less than 0, only cut playback of the same sample
       if (p->cutgroup == group && (group > 0 || p->sample == s->sample)) {
         // schedule this sound to end in ROUNDOFF samples time, so we
         // don't get a click
-        float newend = p->position + ROUNDOFF;
+        float position = position_at(p, s->offset);
+        float newend = position + ROUNDOFF;
         // unless it's dying soon anyway..
         if (newend < p->end) {
+          if (p->end - p->position > ROUNDOFF) {
+            voices_dying++;
+          }
           p->end = newend;
           // cut_continue means start the next where the prev is leaving off
-          if (s->cut_continue > 0 && p->position < s->end) {
-            s->start = p->position;
-            s->position = p->position;
+          if (s->cut_continue > 0 && position < s->end) {
+            s->start = position;
+            s->position = position;
             s->cut_continue = 0;
           }
         }
         // cut should also kill any looping
         p->sample_loop = 0;
       }
-      p = p->next;
     }
   }
 }
 
-void dequeue(sampletime_t now) {
-  t_sound *p;
-  pthread_mutex_lock(&queue_waiting_lock);
-  assert(waiting == NULL || waiting->next != waiting);
-
-  while ((p = queue_next(&waiting, now)) != NULL) {
-    int s = queue_size(playing);
-    cut(p);
-    p->prev = NULL;
-    p->next = playing;
-
-    p->is_playing = 1;
-    playing_n++;
-    
-    if (playing != NULL) {
-      playing->prev = p;
+// The governor's limit is a soft one: once that many sounds are
+// playing, not counting those about to finish, starting another one
+// ends the oldest. Rather than stop immediately, it's set to finish in
+// ROUNDOFF samples, so the roundoff envelope avoids audio clicks. As
+// voices are kept in the order they started, the oldest are the first
+// that aren't dying already. This ends as many as it takes to leave
+// keep playing, from offset frames into the next block.
+
+static void cull(int offset, int keep) {
+  for (int i = 0; i < voices_n && (voices_n - voices_dying) > keep; ++i) {
+    t_voice *p = &voices[i];
+    if ((p->end - p->position) > ROUNDOFF) {
+      p->end = position_at(p, offset) + ROUNDOFF;
+      voices_dying++;
+      governor_culled(governor);
     }
-    playing = p;
-#ifdef DEBUG
-    assert(s == (queue_size(playing) - 1));
-#endif
-
-    //printf("done.\n");
   }
-  pthread_mutex_unlock(&queue_waiting_lock);
 }
 
-float compress(float in) {
-  static float env = 0;
-  env += (float) 50 / g_samplerate;
-  if (fabs(in * env) > 1) {
-    env = env / (float) fabs(in * env);
+// Takes a sound's pre-rendered frames as it starts, if they're ready.
+// If not, the worker's left to give up on them, as the sound will be
+// rendered here instead.
+
+static t_prerender *claim_prerender(t_sound *sound) {
+  t_prerender *pre = sound->prerender;
+  int state;
+
+  if (pre == NULL) {
+    return NULL;
+  }
+  state = __atomic_load_n(&pre->state, __ATOMIC_ACQUIRE);
+  while (state == PRE_QUEUED || state == PRE_RUNNING) {
+    if (__atomic_compare_exchange_n(&pre->state, &state, PRE_ABANDONED, false,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+      return NULL;
+    }
   }
-  return(env);
+  return (state == PRE_READY) ? pre : NULL;
 }
 
-float compressdave(float in) {
-  static float threshold = 0.5;
-  static float env = 0;
-  float result = in;
-  // square input (to abs and make logarithmic)
-  float t=in*in;
+// Copies the effect state pre-rendering left behind into a sound, for
+// it to carry on from once its pre-rendered frames run out
 
-  // blend to create simple envelope follower
-  env = env*(1-compression_speed) + t*compression_speed;
+static void resume_prerender(t_voice *p) {
+  t_prerender *pre = p->pre;
+  int channels = p->mono ? 1 : p->channels;
 
-  // if we are over the threshold
-  if (env > threshold) {
-    // calculate the gain related to amount over thresh
-    result *= 1.0f / (1.0f+(env - threshold));
-  }
-  return(result);
+  memcpy(p->vcf, pre->vcf, sizeof(t_vcf) * channels);
+  memcpy(p->hpf, pre->hpf, sizeof(t_vcf) * channels);
+  memcpy(p->bpf, pre->bpf, sizeof(t_vcf) * channels);
+  memcpy(p->coarsef, pre->coarsef, sizeof(t_crs) * channels);
+  memcpy(p->formant, pre->formant, sizeof(t_formant) * channels);
 }
 
-/**/
+// Hands a sound's pre-rendering back once it's done with
 
-void playback(float **buffers, int frame, sampletime_t now) {
-  int channel, isgn;
-  t_sound *p = playing;
+static void release_prerender(t_voice *p) {
+  __atomic_store_n(&p->pre->state, PRE_FREE, __ATOMIC_RELEASE);
+  p->pre = NULL;
+}
 
-#ifdef SEND_RMS
-  for (int i = 0; i < (MAX_ORBIT*2); ++i) {
-    rms[i].sum = 0;
-    rms[i].n = (rms[i].n + 1) % RMS_SZ;
+// Called once a playing sound has finished (or been merged), to free
+// it up for reuse
+
+static void retire(t_sound *sound) {
+  sound->active = 0;
+  sound->is_playing = 0;
+  free_sound(sound);
+}
+
+// Whether two sounds were triggered the same way, other than how loud,
+// so would play the same but for their gain
+
+static int same_but_gain(const t_sound *a, const t_sound *b) {
+  return a->sample == b->sample
+    && a->startT == b->startT
+    && a->loop_start == b->loop_start
+    && a->speed == b->speed
+    && a->pan == b->pan
+    && a->offset == b->offset
+    && a->start == b->start
+    && a->end == b->end
+    && a->velocity == b->velocity
+    && a->formant_vowelnum == b->formant_vowelnum
+    && a->cutoff == b->cutoff
+    && a->resonance == b->resonance
+    && a->accelerate == b->accelerate
+    && a->shape == b->shape
+    && a->shape_k == b->shape_k
+    && a->kriole_chunk == b->kriole_chunk
+    && a->is_kriole == b->is_kriole
+    && a->delay == b->delay
+    && a->delaytime == b->delaytime
+    && a->delayfeedback == b->delayfeedback
+    && a->cutgroup == b->cutgroup
+    && a->crush == b->crush
+    && a->crush_bits == b->crush_bits
+    && a->coarse == b->coarse
+    && a->hcutoff == b->hcutoff
+    && a->hresonance == b->hresonance
+    && a->bandf == b->bandf
+    && a->bandq == b->bandq
+    && a->sample_loop == b->sample_loop
+    && a->unit == b->unit
+    && a->cps == b->cps
+    && a->attack == b->attack
+    && a->hold == b->hold
+    && a->release == b->release
+    && a->orbit == b->orbit
+    && a->interpolation == b->interpolation;
+}
+
+// Layered patterns often trigger the same sound more than once at the
+// same time, differing only in gain. Rather than play each, a sound
+// that's a duplicate of one started since run, and not since cut or
+// culled, is folded into it by adding its gain, as the gain is applied
+// after everything else. In a cut group the last would cut the others
+// off, so it's only folded into the one started just before it, whose
+// gain it takes over. Sounds carrying on from a cut one depend on
+// where that was, so are left alone. Returns whether it was merged.
+
+static int merge_duplicate(t_sound *sound, int run) {
+  t_prerender *pre;
+  int i = voices_n - 1;
+
+  if (sound->voice.cut_continue) {
+    return 0;
   }
-#endif
-  
-  for (channel = 0; channel < g_num_channels; ++channel) {
-    buffers[channel][frame] = 0;
+  for (; i >= run; --i) {
+    t_voice *voice = &voices[i];
+    t_voice *given = &voice->sound->voice;
+
+    if (voice->end == given->end && voice->sample_loop == given->sample_loop
+        && same_but_gain(voice->sound, sound)) {
+      break;
+    }
+    if (sound->cutgroup != 0) {
+      return 0;
+    }
+  }
+  if (i < run) {
+    return 0;
   }
 
-  while (p != NULL) {
-    int channels;
-    t_sound *tmp;
+  if (sound->cutgroup != 0) {
+    voices[i].gain = sound->voice.gain;
+  }
+  else {
+    voices[i].gain += sound->voice.gain;
+  }
 
-    if (p->startT > now) {
-      p->checks++;
-      p = p->next;
+  // it won't be played, so let go of what it was given for that
+  pre = claim_prerender(sound);
+  if (pre != NULL) {
+    __atomic_store_n(&pre->state, PRE_FREE, __ATOMIC_RELEASE);
+  }
+  if (sound->voice.cache != NULL) {
+    rendercache_release(render_cache, sound->voice.cache);
+  }
+  retire(sound);
+  __atomic_store_n(&merged, merged + 1, __ATOMIC_RELAXED);
+  return 1;
+}
+
+// Moves sounds handed over by the OSC and file loading threads into
+// the waiting queue
+
+static void receive(void) {
+  t_sound *p;
+
+  while ((p = mpsc_pop(incoming)) != NULL) {
+    waiting_add(p);
+  }
+}
+
+// Starts the sounds due within the next frames frames, each from the
+// first frame at or after its start time, merging duplicates of those
+// started at the same time. Frame i is taken to be at
+// time now + i * frame_duration.
+
+void dequeue(sampletime_t now, int frames, double frame_duration) {
+  sampletime_t last = now + (sampletime_t) ((frames - 1) * frame_duration);
+  // the first of the sounds started at the same time, which come out
+  // of the queue together
+  int run = voices_n;
+  t_sound *p;
+
+  while ((p = waiting_next(last)) != NULL) {
+    t_voice *voice = &voices[voices_n];
+    double offset = ceil(((double) p->startT - (double) now) / frame_duration);
+
+    assert(voices_n < MAX_SOUNDS);
+
+    if (run < voices_n && voices[run].startT != p->startT) {
+      run = voices_n;
+    }
+    if (merge_duplicate(p, run)) {
       continue;
     }
-    if ((!p->started) && p->checks == 0 && p->startT < now) {
-      /*      printf("started late by %f frames (%d checks)\n",
-	     now - p->startT, p->checks
-	     );*/
-      p->started = 1;
+
+    *voice = p->voice;
+    voice->pre = claim_prerender(p);
+    if (p->delaytime >= 0) {
+      delays[p->orbit].time = p->delaytime;
+    }
+    if (p->delayfeedback >= 0) {
+      delays[p->orbit].feedback = p->delayfeedback;
     }
-    //printf("playing %s\n", p->samplename);
-    channels = p->channels;
+    voice->offset = (offset < 0) ? 0 : (offset > frames - 1) ? frames - 1 : (int) offset;
+    cull(voice->offset, (int) governor_limit(governor) - 1);
+    cut(voice);
+    cut_add(voices_n);
+    if (voice->end - voice->position <= ROUNDOFF) {
+      voices_dying++;
+    }
+    p->is_playing = 1;
+    voices_n++;
+  }
+}
 
-    //printf("channels: %d\n", channels);
-    for (channel = 0; channel < channels; ++channel) {
-      float roundoff = 1;
-      float value;
+/**/
 
-      value = p->items[(channels * (p->reverse ? (p->sample->info->frames - (int) p->position) : (int) p->position)) + channel];
+// Fetches n values of one channel of a sound, interpolated as it asks.
+// The higher qualities look at frames either side, which are kept
+// within the sample.
+
+static void fetch(t_voice *p, float *buf, int channel, const int *index,
+                  const int *next, const float *tween, int n) {
+  const float *items = p->items + channel;
+  int stride = p->reverse ? -p->channels : p->channels;
+  int hi = (p->frames - 1) * p->channels;
+  int octave = 0;
+
+  switch (p->interpolation) {
+  case INTERP_CUBIC:
+    kernels.fetch_cubic(buf, items, index, stride, 0, hi, tween, n);
+    break;
+  case INTERP_SINC:
+    // pitching up needs a narrower band to keep out aliasing
+    while (octave < SINC_OCTAVES - 1 && (float) (1 << octave) < p->speed) {
+      octave++;
+    }
+    kernels.fetch_sinc(buf, items, index, stride, 0, hi, tween, n, octave);
+    break;
+  default:
+    kernels.fetch(buf, items, index, next, tween, n);
+    break;
+  }
+}
 
-      int pos = ((int) p->position) + 1;
-      if (pos < p->end) {
-        float next =
-          p->items[(channels * (p->reverse ? p->sample->info->frames - pos : pos))
-                    + channel
-                    ];
-        float tween_amount = (p->position - (int) p->position);
+/**/
 
-        /* linear interpolation */
-        value += (next - value) * tween_amount;
-      }
+// Works out where in the sample the next frames of a sound come from,
+// and their gain and roundoff, moving the sound on. Returns how many
+// frames that is, fewer than asked for if the sound ends, when playing
+// is cleared. Frames are interpolated towards the next up to where the
+// sound was given to end, even once it's been cut or culled, so what
+// was rendered ahead or cached before then still matches.
+
+static int step_voice(t_voice *p, int *index, int *next, float *tween, float *amp,
+                      int frames, int *playing) {
+  int n;
+
+  for (n = 0; n < frames && *playing;) {
+    float roundoff = 1;
+    int frame = (int) p->position;
+    int pos = frame + 1;
+
+    index[n] = p->channels * (p->reverse ? (p->frames - frame) : frame);
+    tween[n] = p->position - frame;
+    if (pos < p->given_end) {
+      next[n] = p->channels * (p->reverse ? p->frames - pos : pos);
+    }
+    else {
+      next[n] = index[n];
+    }
 
-      if (p->formant_vowelnum >= 0) {
-        value = formant_filter(value, p, 0);
+    if ((p->end - p->position) < ROUNDOFF) {
+      // TODO what if end < ROUNDOFF?)
+      roundoff = (p->end - p->position) / (float) ROUNDOFF;
+    }
+    else {
+      if ((p->position - p->start) < ROUNDOFF) {
+        roundoff = (p->position - p->start) / (float) ROUNDOFF;
       }
+    }
 
-      // why 44000 (or 44100)? init_vcf divides by samplerate..
-      if (p->resonance > 0 && p->resonance < 1
-	  && p->cutoff > 0 && p->cutoff < 1) {
-	value = effect_vcf(value, p, channel);
-      }
-      if (p->hresonance > 0 && p->hresonance < 1
-          && p->hcutoff > 0 && p->hcutoff < 1) {
-        value = effect_hpf(value, p, channel);
-      }
-      if (p->bandf > 0 && p->bandf < 1 && p->bandq > 0) {
-         value = effect_bpf(value, p, channel);
-      } else if (p->bandf < 0 && p->bandf > -1 && p->bandq > 0) {
-         value = value - effect_bpf(value, p, channel);
-      }
+    amp[n++] = p->gain * roundoff;
 
-      if ((p->end - p->position) < ROUNDOFF) {
-        // TODO what if end < ROUNDOFF?)
-        //printf("roundoff: %f\n", (p->end - pos) / (float) ROUNDOFF);
-        roundoff = (p->end - p->position) / (float) ROUNDOFF;
-        //printf("end roundoff: %f (%f)\n", roundoff, p->end - p->position);
-      }
-      else {
-        if ((p->position - p->start) < ROUNDOFF) {
-          roundoff = (p->position - p->start) / (float) ROUNDOFF;
-          //printf("start roundoff: %f (%f / %d)\n", roundoff, p->position - p->start, ROUNDOFF);
-        }
-      }
+    if (p->accelerate != 0) {
+      // ->startFrame ->end ->position
+      p->speed += p->accelerate/g_samplerate;
+    }
+    p->position += p->speed;
 
-      if (p->coarse != 0) {
-        value = effect_coarse(value, p, channel);
+    if (p->position >= p->end || p->position < p->start) {
+      if (--(p->sample_loop) > 0) {
+        p->position = p->start;
+      } else {
+        *playing = 0;
       }
+    }
+  }
+  return(n);
+}
 
-      if (p->shape) {
-        value = (1+p->shape_k)*value/(1+p->shape_k*(float) fabs(value));
-        // gain compensation, fine-tuned by ear
-        if (use_shape_gain_comp) {
-          float gcomp = 1.0f - (0.15f * p->shape_k / (p->shape_k + 2.0f));
-          value *= gcomp * gcomp;
-        }
-      }
-      if (p->crush > 0) {
-        //value = (1.0 + log(fabs(value)) / 16.63553) * (value / fabs(value));
-	float tmp = myPow(2,p->crush_bits-1);
-        value = (float) trunc(tmp * value) / tmp;
-        //value = exp( (fabs(value) - 1.0) * 16.63553 ) * (value / fabs(value));
-      } else if (p->crush < 0) {
-        isgn = (value >= 0) ? 1 : -1;
-        value = isgn * myPow(fabsf(value), 0.125);
-        value = (float) trunc(((float) myPow(2,p->crush_bits-1) * value)) / ((float) myPow(2,p->crush_bits-1));
-        value = isgn * myPow(value, 8.0);
-      }
+// Fetches n values of one channel of a sound and runs them through its
+// effects
 
+static void render_channel(t_voice *p, float *buf, int channel, const int *index,
+                           const int *next, const float *tween, int n) {
+  fetch(p, buf, channel, index, next, tween, n);
 
-      value *= p->gain;
-      // envelope
-      float env = 1.0;
-      if (p->attack >= 0 && p->release >= 0) {
-        if (p->playtime < p->attack) {
-          env = 1.0523957 - 1.0523958*exp(-3.0 * p->playtime/p->attack);
-        } else if (p->playtime > (p->attack + p->hold + p->release)) {
-          env = 0.0;
-        } else if (p->playtime > (p->attack + p->hold)) {
-          env = 1.0523957 *
-            exp(-3.0 * (p->playtime - p->attack - p->hold) / p->release) 
-            - 0.0523957;
-        }
-      }
-      value *= env;
+  for (int i = 0; i < p->effects_n; ++i) {
+    p->effects[i](buf, n, p, channel);
+  }
+}
+
+// Copies n values of one channel of a sound from the render cache,
+// padded with silence if it's been made to end later than it would
+
+static void read_cached(t_voice *p, float *buf, int channel, int n) {
+  const float *samples = rendercache_samples(p->cache, channel);
+  int m = (int) rendercache_frames(p->cache) - p->played;
+
+  m = (m < 0) ? 0 : (m > n) ? n : m;
+  memcpy(buf, samples + p->played, sizeof(float) * m);
+  memset(buf + m, 0, sizeof(float) * (n - m));
+}
+
+/**/
+
+// Renders one sound into the first frames of a bus, from the frame it
+// starts at if that's in this block. Sample offsets, envelope and
+// roundoff are worked out for the whole span up front, then each
+// channel is fetched (or copied from the render cache or what was
+// pre-rendered), run through the effects and mixed in a single pass.
+// Returns 0 once the sound has finished playing.
+
+static int playback_sound(t_bus *bus, t_voice *p, int frames) {
+  int index[MAX_BLOCK];
+  int next[MAX_BLOCK];
+  float tween[MAX_BLOCK];
+  float amp[MAX_BLOCK];
+  float buf[MAX_BLOCK];
+  t_orbit_bus *orbit;
+  float peak = 0;
+  int playing = 1;
+  int channel, n;
+  int skip = 0;
+  int ahead = 0;
+
+  // sounds start partway into the block they're dequeued for
+  if (p->offset > 0) {
+    skip = (p->offset < frames) ? p->offset : frames;
+    p->offset -= skip;
+    frames -= skip;
+    if (frames == 0) {
+      return(1);
+    }
+  }
+
+  n = step_voice(p, index, next, tween, amp, frames, &playing);
+
+  if (p->env_stage != ENV_NONE) {
+    envelope(p, amp, n);
+    // nothing more will be heard once the envelope's over
+    if (p->env_stage == ENV_DONE) {
+      playing = 0;
+    }
+  }
 
-      value *= roundoff;
+  orbit = &bus->orbits[p->orbit];
+  if (!(bus->orbits_used & (1u << p->orbit))) {
+    for (channel = 0; channel < g_num_channels; ++channel) {
+      memset(orbit->out[channel], 0, sizeof(float) * (skip + frames));
+    }
+    bus->orbits_used |= 1u << p->orbit;
+  }
+  if (p->delay > 0 && !(bus->sends_used & (1u << p->orbit))) {
+    for (channel = 0; channel < g_num_channels; ++channel) {
+      memset(orbit->sends[channel], 0, sizeof(float) * (skip + frames));
+    }
+    bus->sends_used |= 1u << p->orbit;
+  }
 
-      float c = (float) channel + p->pan;
-      float d = c - (float) floor(c);
-      int channel_a =  ((int) c) % g_num_channels;
-      int channel_b =  ((int) c + 1) % g_num_channels;
+  // frames rendered ahead, if any, then carry on from where they left off
+  if (p->pre != NULL) {
+    ahead = p->pre->frames - p->played;
+    ahead = (ahead < 0) ? 0 : (ahead > n) ? n : ahead;
+    if (ahead < n) {
+      resume_prerender(p);
+    }
+  }
 
-      if (channel_a < 0) {
-        channel_a += g_num_channels;
+  for (channel = 0; channel < (p->mono ? 1 : p->channels); ++channel) {
+    t_pan *pan = &p->pans[channel];
+
+    if (p->cache != NULL) {
+      read_cached(p, buf, channel, n);
+    }
+    else {
+      if (ahead > 0) {
+        memcpy(buf, p->pre->samples + channel * prerender_frames + p->played,
+               sizeof(float) * ahead);
       }
-      if (channel_b < 0) {
-        channel_b += g_num_channels;
+      if (ahead < n) {
+        render_channel(p, buf + ahead, channel, index + ahead, next + ahead,
+                       tween + ahead, n - ahead);
       }
+    }
 
-      // equal power panning
-      // PERF - 8.4% of time?
-      float tmpa, tmpb;
-      // optimisations for middle, hard left + hard right
-      if (d == 0.5f) {
-	tmpa = tmpb = value * 0.7071067811f;
-      }
-      else if (d == 0) {
-	tmpa = value;
-	tmpb = 0;
+    kernels.gain(buf, amp, n);
+
+    if (g_silence > 0) {
+      for (int i = 0; i < n; ++i) {
+        float level = fabsf(buf[i]);
+        peak = (level > peak) ? level : peak;
       }
-      else if (d == 1) {
-	tmpa = 0;
-	tmpb = value;
+    }
+
+    kernels.pan(orbit->out[pan->channel_a] + skip, orbit->out[pan->channel_b] + skip,
+                buf, pan->gain_a, pan->gain_b, n);
+    if (p->delay > 0) {
+      kernels.pan(orbit->sends[pan->channel_a] + skip, orbit->sends[pan->channel_b] + skip,
+                  buf, pan->gain_a * p->delay, pan->gain_b * p->delay, n);
+    }
+  }
+  p->played += n;
+  if (p->pre != NULL && ahead < n) {
+    release_prerender(p);
+  }
+
+  // Once it's been heard, a sound that stays below the silence
+  // threshold for long enough has finished, even if there's more of
+  // the sample to go. The wait lets filter tails die away, and a sound
+  // still to loop round again is left alone.
+  if (g_silence > 0 && playing) {
+    if (peak >= g_silence || p->sample_loop > 1) {
+      p->audible |= (peak >= g_silence);
+      p->quiet = 0;
+    }
+    else if (p->audible) {
+      p->quiet += n;
+      if (p->quiet >= SILENCE_TIME * g_samplerate) {
+        playing = 0;
       }
-      else {
-	tmpa = value * (float) cos(HALF_PI * d);
-	tmpb = value * (float) sin(HALF_PI * d);
+    }
+  }
+
+  return(playing);
+}
+
+/**/
+
+static void clear_bus(t_bus *bus) {
+  bus->orbits_used = 0;
+  bus->sends_used = 0;
+  bus->block = render_block;
+}
+
+/**/
+
+static void add_channels(float to[][MAX_BLOCK], float from[][MAX_BLOCK], int copy, int frames) {
+  for (int channel = 0; channel < g_num_channels; ++channel) {
+    if (copy) {
+      memcpy(to[channel], from[channel], sizeof(float) * frames);
+    }
+    else {
+      for (int i = 0; i < frames; ++i) {
+        to[channel][i] += from[channel][i];
       }
+    }
+  }
+}
+
+static void add_bus(t_bus *to, t_bus *from, int frames) {
+  for (int orbit = 0; orbit < MAX_ORBIT; ++orbit) {
+    unsigned int bit = 1u << orbit;
 
-      buffers[channel_a][frame] += tmpa;
-      buffers[channel_b][frame] += tmpb;
+    if (from->orbits_used & bit) {
+      add_channels(to->orbits[orbit].out, from->orbits[orbit].out,
+                   !(to->orbits_used & bit), frames);
+      to->orbits_used |= bit;
+    }
+    if (from->sends_used & bit) {
+      add_channels(to->orbits[orbit].sends, from->orbits[orbit].sends,
+                   !(to->sends_used & bit), frames);
+      to->sends_used |= bit;
+    }
+  }
+}
 
 #ifdef SEND_RMS
-      rms[p->orbit*2 + channel_a].sum += tmpa;
-      rms[p->orbit*2 + channel_b].sum += tmpb;
-#endif
-      
-      if (p->delay > 0) {
-	add_delay(&delays[channel_a], tmpa, delay_time, p->delay);
-	add_delay(&delays[channel_b], tmpb, delay_time, p->delay);
-      }
+// Replaces the oldest n squares in a meter's ring, from at, with those
+// of in, or with silence if in is NULL
 
-      if (p->mono) {
-        break;
-      }
+static void meter_piece(t_rms *meter, const float *in, int at, int n) {
+  float *squares = meter->squares + at;
+  float removed = 0;
+  float added = 0;
+
+  for (int i = 0; i < n; ++i) {
+    removed += squares[i];
+  }
+  if (in != NULL) {
+    for (int i = 0; i < n; ++i) {
+      squares[i] = in[i] * in[i];
+    }
+    for (int i = 0; i < n; ++i) {
+      added += squares[i];
     }
+  }
+  else {
+    memset(squares, 0, sizeof(float) * n);
+  }
+  meter->sum_of_squares += (double) added - removed;
+}
 
-    if (p->accelerate != 0) {
-      // ->startFrame ->end ->position
-      p->speed += p->accelerate/g_samplerate;
+// Keeps a running sum of squares over the last RMS_WINDOW seconds of
+// the first two channels of each orbit, and publishes their levels
+
+static void meter_orbits(t_bus *bus, int frames) {
+  int window = __atomic_load_n(&rms_window, __ATOMIC_ACQUIRE);
+  if (window == 0) {
+    return;
+  }
+
+  // the block goes into the rings in at most two pieces
+  int first = window - rms_point;
+  if (first > frames) {
+    first = frames;
+  }
+
+  for (int j = 0; j < MAX_ORBIT*2; ++j) {
+    t_rms *meter = &rms[j];
+    int orbit = j / 2;
+    int channel = j % 2;
+    float *out = NULL;
+
+    if ((bus->orbits_used & (1u << orbit)) && channel < g_num_channels) {
+      out = bus->orbits[orbit].out[channel];
+      meter->quiet = 0;
+    }
+    else if (meter->quiet >= window) {
+      // the ring is all silence already
+      continue;
+    }
+    else {
+      meter->quiet += frames;
     }
-    p->position += p->speed;
-    p->playtime += 1.0 / g_samplerate;
 
-    p->played++;
-    //printf("position: %d of %d\n", p->position, playing->end);
-    /* remove dead sounds */
-    tmp = p;
-    p = p->next;
-    if (tmp->position >= tmp->end || tmp->position < tmp->start) {
-      if (--(tmp->sample_loop) > 0) {
-        tmp->position = tmp->start;
-      } else {
-        queue_remove(&playing, tmp);
-      }
+    meter_piece(meter, out, rms_point, first);
+    meter_piece(meter, out ? out + first : NULL, 0, frames - first);
+
+    // rounding errors would otherwise linger, or go below zero
+    if (meter->quiet >= window || meter->sum_of_squares < 0) {
+      meter->sum_of_squares = 0;
     }
   }
+  rms_point = (rms_point + frames) % window;
 
-  for (channel = 0; channel < g_num_channels; ++channel) {
-    float tmp = shift_delay(&delays[channel]);
-    if (delay_feedback > 0 && tmp != 0) {
-      add_delay(&delays[channel], tmp, delay_time, delay_feedback);
+  __atomic_store_n(&rms_seq, rms_seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  for (int j = 0; j < MAX_ORBIT*2; ++j) {
+    float level = (float) sqrt(rms[j].sum_of_squares / window);
+    __atomic_store(&rms_levels[j], &level, __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&rms_seq, rms_seq + 1, __ATOMIC_RELEASE);
+}
+#endif
+
+// Runs an orbit's effects once over everything played on it, and
+// mixes the result into buffers
+
+static void mix_orbit(t_bus *bus, int orbit, float **buffers, int offset, int frames) {
+  t_orbit_bus *o = &bus->orbits[orbit];
+  unsigned int bit = 1u << orbit;
+  t_delay *delay = &delays[orbit];
+
+  if (!(bus->orbits_used & bit)) {
+    if (!delay_live(delay)) {
+      return;
+    }
+    // nothing played on it, but there are echoes still to come
+    for (int channel = 0; channel < g_num_channels; ++channel) {
+      memset(o->out[channel], 0, sizeof(float) * frames);
     }
-    buffers[channel][frame] += tmp;
   }
 
-  if (use_dirty_compressor) {
-    float max = 0;
+  if ((bus->sends_used & bit) || delay_live(delay)) {
+    run_delay(delay, (bus->sends_used & bit) ? o->sends : NULL, o->out, frames);
+  }
 
-    for (channel = 0; channel < g_num_channels; ++channel) {
-      if (fabsf(buffers[channel][frame]) > max) {
-        max = buffers[channel][frame];
-      }
+  for (int channel = 0; channel < g_num_channels; ++channel) {
+    float *out = buffers[channel] + offset;
+    for (int i = 0; i < frames; ++i) {
+      out[i] += o->out[channel][i];
     }
-    float factor = compress(max);
-    for (channel = 0; channel < g_num_channels; ++channel) {
-      buffers[channel][frame] *= factor * g_gain/5.0f;
+  }
+}
+
+// Whether any orbit's delay has echoes still to come
+
+static int delays_live(void) {
+  for (int orbit = 0; orbit < MAX_ORBIT; ++orbit) {
+    if (delay_live(&delays[orbit])) {
+      return(1);
     }
-  } else {
+  }
+  return(0);
+}
+
+// Renders one of the playing sounds, called from the audio thread
+// (worker 0) or a render pool thread
+
+static void render_job(unsigned int worker, unsigned int job, void *arg) {
+  t_bus *bus = &buses[worker];
+
+  if (bus->block != render_block) {
+    clear_bus(bus);
+  }
+  render_playing[job] = playback_sound(bus, &voices[job], render_frames);
+}
+
+/**/
+
+// Renders frames [offset, offset+frames) of a period. No sounds start
+// or stop being due within the span, so every playing sound is rendered
+// for the whole of it (or until it ends) in one go.
+
+void playback(float **buffers, int offset, int frames) {
+  int channel, i;
+  int n = voices_n;
+  t_bus *bus = &buses[0];
+
+  assert(frames <= MAX_BLOCK);
+
+  render_frames = frames;
+  render_block++;
+  clear_bus(bus);
+
+  // with nothing playing and no echoes to come, the block is silent
+  if (n == 0 && !delays_live()) {
+#ifdef SEND_RMS
+    meter_orbits(bus, frames);
+#endif
     for (channel = 0; channel < g_num_channels; ++channel) {
-      buffers[channel][frame] *= g_gain;
+      memset(buffers[channel] + offset, 0, sizeof(float) * frames);
     }
+    dynamics_silence(&master_dynamics, frames, g_gain, g_samplerate);
+    return;
   }
-  #ifdef SEND_RMS
-  for (int i = 0; i < MAX_ORBIT*2; ++i) {
-    rms[i].sum_of_squares -= rms[i].squares[rms[i].n];
 
-    // this happens sometimes. could be a floating point error?
-    if (rms[i].sum_of_squares < 0) {
-      rms[i].sum_of_squares = 0;
+  if (render_pool != NULL && n > 1) {
+    renderpool_run(render_pool, n);
+    for (unsigned int w = 1; w <= renderpool_size(render_pool); ++w) {
+      if (buses[w].block == render_block) {
+        add_bus(bus, &buses[w], frames);
+      }
     }
-    
-    if (rms[i].sum == 0) {
-      rms[i].squares[rms[i].n] = 0;
+  }
+  else {
+    for (i = 0; i < n; ++i) {
+      render_job(0, i, NULL);
     }
-    else {
-      float sqrd = rms[i].sum * rms[i].sum;
-      rms[i].squares[rms[i].n] = sqrd;
-      rms[i].sum_of_squares += sqrd;
+  }
+
+  /* remove dead sounds, keeping the rest in order */
+  voices_n = 0;
+  voices_dying = 0;
+  cut_clear();
+  for (i = 0; i < n; ++i) {
+    if (!render_playing[i]) {
+      if (voices[i].cache != NULL) {
+        rendercache_release(render_cache, voices[i].cache);
+      }
+      if (voices[i].pre != NULL) {
+        release_prerender(&voices[i]);
+      }
+      retire(voices[i].sound);
+      continue;
+    }
+    if (voices_n != i) {
+      voices[voices_n] = voices[i];
     }
+    if (voices[voices_n].end - voices[voices_n].position <= ROUNDOFF) {
+      voices_dying++;
+    }
+    cut_add(voices_n);
+    voices_n++;
   }
-  #endif
-}
 
+#ifdef SEND_RMS
+  meter_orbits(bus, frames);
+#endif
 
-#ifdef JACK
-extern int jack_callback(int frames, float *input, float **outputs) {
-    sampletime_t now;
+  for (channel = 0; channel < g_num_channels; ++channel) {
+    memset(buffers[channel] + offset, 0, sizeof(float) * frames);
+  }
+  for (int orbit = 0; orbit < MAX_ORBIT; ++orbit) {
+    mix_orbit(bus, orbit, buffers, offset, frames);
+  }
+
+  dynamics_run(&master_dynamics, buffers, offset, g_num_channels, frames,
+               g_gain, g_samplerate);
+}
 
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    epochOffset = ((double) tv.tv_sec + ((double) tv.tv_usec / 1000000.0))
-      - ((double) jack_get_time() / 1000000.0);
-    //printf("jack time: %d tv_sec %d epochOffset: %f\n", jack_get_time(), tv.tv_sec, epochOffset);
+/**/
+
+// Renders a whole period. Sounds that have arrived since the last
+// period are taken in, those due within the period are started at the
+// frame they're due, and then everything is rendered a block at a
+// time. Frame i of the period is taken to be at time now + i *
+// frame_duration.
 
-  now = jack_last_frame_time(jack_client);
+void process(float **buffers, int frames, sampletime_t now, double frame_duration) {
+  governor_start(governor);
+  receive();
+  dequeue(now, frames, frame_duration);
 
-  for (int i=0; i < frames; ++i) {
-    jack_time_t nowt = jack_frames_to_time(jack_client, now + i);
-    playback(outputs, i, nowt);
+  for (int i = 0; i < frames; i += MAX_BLOCK) {
+    int n = frames - i;
 
-    dequeue(nowt);
+    if (n > MAX_BLOCK) {
+      n = MAX_BLOCK;
+    }
+    playback(buffers, i, n);
   }
+
+  governor_finish(governor, frames * frame_duration, voices_n - voices_dying);
+  // if the limit's come down, the sounds over it are ended right away
+  cull(0, (int) governor_limit(governor));
+}
+
+extern void audio_stats(governor_stats_t *stats) {
+  governor_stats(governor, stats);
+}
+
+extern unsigned long audio_merged(void) {
+  return __atomic_load_n(&merged, __ATOMIC_RELAXED);
+}
+
+
+#ifdef JACK
+extern int jack_callback(int frames, float *input, float **outputs) {
+  audioclock_update(audio_clock, jack_last_frame_time(jack_client), frames,
+                    g_samplerate, audioclock_now());
+
+  process(outputs, frames, audioclock_time(audio_clock),
+          audioclock_frame_duration(audio_clock));
   return(0);
 }
 #elif PULSE
 
 void run_pulse() {
   #define FRAMES 64
-  struct timeval tv;
-  double samplelength = (((double) 1)/((double) g_samplerate));
+  unsigned int frame = 0;
 
   float *buf[g_num_channels];
   for (int i = 0 ; i < g_num_channels; ++i) {
@@ -1097,16 +2286,18 @@ void run_pulse() {
     }
     //fprintf(stderr, "%f sec    \n", ((float)latency)/1000000.0f);
 
-    gettimeofday(&tv, NULL);
-    double now = ((double) tv.tv_sec + ((double) tv.tv_usec / 1000000.0));
+    // what's written now is heard once what's already buffered has
+    // played
+    audioclock_update(audio_clock, frame, FRAMES, g_samplerate,
+                      audioclock_now() + ((double) latency / 1000000.0));
+    frame += FRAMES;
 
+    process(buf, FRAMES, audioclock_time(audio_clock),
+            audioclock_frame_duration(audio_clock));
     for (int i=0; i < FRAMES; ++i) {
-      double framenow = now + (samplelength * (double) i);
-      playback(buf, i, framenow);
       for (int j=0; j < g_num_channels; ++j) {
 	interlaced[g_num_channels*i+j] = buf[j][i];
       }
-      dequeue(framenow);
     }
 
     if (pa_simple_write(s, interlaced, sizeof(interlaced), &error) < 0) {
@@ -1134,32 +2325,24 @@ static int pa_callback(const void *inputBuffer, void *outputBuffer,
 		       const PaStreamCallbackTimeInfo* timeInfo,
 		       PaStreamCallbackFlags statusFlags,
 		       void *userData) {
+  static unsigned int frame = 0;
+  double latency = 0;
 
-  struct timeval tv;
-
-  if (epochOffset == 0) {
-    gettimeofday(&tv, NULL);
-    #ifdef HACK
-    epochOffset = 0;
-    #else
-    epochOffset = ((double) tv.tv_sec + ((double) tv.tv_usec / 1000000.0))
-      - timeInfo->outputBufferDacTime;
-    #endif
-    /* printf("set offset (%f - %f) to %f\n", ((float) tv.tv_sec + ((float) tv.tv_usec / 1000000.0f))
-       , timeInfo->outputBufferDacTime, epochOffset); */
-  }
-  #ifdef HACK
-  double now = ((double) tv.tv_sec + ((double) tv.tv_usec / 1000000.0));
-  #else
-  double now = timeInfo->outputBufferDacTime;
+  #ifndef HACK
+  // some host APIs don't fill in the times, so only trust them if
+  // they're both there
+  if (timeInfo->outputBufferDacTime > 0 && timeInfo->currentTime > 0) {
+    latency = timeInfo->outputBufferDacTime - timeInfo->currentTime;
+  }
   #endif
+  audioclock_update(audio_clock, frame, framesPerBuffer, g_samplerate,
+                    audioclock_now() + latency);
+  frame += framesPerBuffer;
+
   // printf("%f %f %f\n", timeInfo->outputBufferDacTime, timeInfo->currentTime,   Pa_GetStreamTime(stream));
   float **buffers = (float **) outputBuffer;
-  for (int i=0; i < framesPerBuffer; ++i) {
-    double framenow = now + (((double) i)/((double) g_samplerate));
-    playback(buffers, i, framenow);
-    dequeue(framenow);
-  }
+  process(buffers, framesPerBuffer, audioclock_time(audio_clock),
+          audioclock_frame_duration(audio_clock));
   return paContinue;
 }
 #endif
@@ -1265,29 +2448,44 @@ error:
 #endif
 
 #ifdef SEND_RMS
+// Copies out the levels last published by the audio thread, trying
+// again if they were being written meanwhile
+
+static void read_rms_levels(float *levels) {
+  unsigned int seq;
+
+  do {
+    seq = __atomic_load_n(&rms_seq, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < MAX_ORBIT*2; ++i) {
+      __atomic_load(&rms_levels[i], &levels[i], __ATOMIC_RELAXED);
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while ((seq & 1) || seq != __atomic_load_n(&rms_seq, __ATOMIC_RELAXED));
+}
+
 void thread_send_rms() {
   lo_address a = lo_address_new(NULL, "6010");
-  lo_message m;
-  
+  lo_message m = lo_message_new();
+  float levels[MAX_ORBIT*2];
+
+  // the message is built once, and its arguments overwritten in place
+  for (int i = 0; i < (MAX_ORBIT*2); ++i) {
+    lo_message_add_float(m, 0);
+  }
+  lo_arg **argv = lo_message_get_argv(m);
+
   while(1) {
-    m = lo_message_new();
+    read_rms_levels(levels);
     for (int i = 0; i < (MAX_ORBIT*2); ++i) {
-      if (rms[i].sum_of_squares == 0) {
-	lo_message_add_float(m, 0);
-      }
-      else {
-	float result = sqrt(rms[i].sum_of_squares / RMS_SZ);
-	lo_message_add_float(m, result);
-      }
+      argv[i]->f = levels[i];
     }
     lo_send_message(a, "/rmsall", m);
-    lo_message_free(m);
     usleep(50000);
   }
 }
 #endif
 
-extern void audio_init(bool dirty_compressor, bool autoconnect, bool late_trigger, unsigned int num_workers, char *sroot, bool shape_gain_comp, bool preload_flag) {
+extern void audio_init(bool dirty_compressor, bool autoconnect, bool late_trigger, unsigned int num_workers, unsigned int num_render_workers, unsigned int max_playing, size_t render_cache_size, unsigned int prerender_ms, char *sroot, bool shape_gain_comp, bool preload_flag) {
   struct timeval tv;
 
   atexit(audio_close);
@@ -1296,15 +2494,69 @@ extern void audio_init(bool dirty_compressor, bool autoconnect, bool late_trigge
   sampleroot = sroot;
   starttime = (float) tv.tv_sec + ((float) tv.tv_usec / 1000000.0);
 
-  delays = calloc(g_num_channels, sizeof(t_line));
-  if (!delays) {
-    fprintf(stderr, "no memory to allocate `delays' array\n");
-    exit(1);
+  for (int orbit = 0; orbit < MAX_ORBIT; ++orbit) {
+    delays[orbit].time = 0.1;
+    delays[orbit].feedback = 0.7;
   }
   
-  pthread_mutex_init(&queue_waiting_lock, NULL);
+  kernels_init();
+  fprintf(stderr, "using %s kernels\n", kernels.name);
+
+  dynamics_init(&master_dynamics,
+                dirty_compressor ? DYNAMICS_DIRTY : DYNAMICS_GAIN, g_gain);
+
+  buses = calloc(num_render_workers + 1, sizeof(t_bus));
+  if (!buses) {
+    fprintf(stderr, "no memory to allocate `buses' array\n");
+    exit(1);
+  }
+
+  if (num_render_workers > 0) {
+    render_pool = renderpool_init(num_render_workers, render_job, NULL);
+    if (!render_pool) {
+      fprintf(stderr, "could not initialize `render_pool'\n");
+      exit(1);
+    }
+  }
+
   pthread_mutex_init(&queue_loading_lock, NULL);
-  pthread_mutex_init(&mutex_sounds, NULL);
+
+  audio_clock = audioclock_init(CLOCK_BANDWIDTH);
+  if (!audio_clock) {
+    fprintf(stderr, "could not initialize `audio_clock'\n");
+    exit(1);
+  }
+
+  governor = governor_init(max_playing);
+  if (!governor) {
+    fprintf(stderr, "could not initialize `governor'\n");
+    exit(1);
+  }
+
+  if (render_cache_size > 0) {
+    render_cache = rendercache_init(render_cache_size);
+    if (!render_cache) {
+      fprintf(stderr, "could not initialize `render_cache'\n");
+      exit(1);
+    }
+    render_cache_budget = render_cache_size;
+    render_cache_pool = thpool_init(1);
+    if (!render_cache_pool) {
+      fprintf(stderr, "could not initialize `render_cache_pool'\n");
+      exit(1);
+    }
+  }
+
+  incoming = mpsc_init(MAX_SOUNDS);
+  if (!incoming) {
+    fprintf(stderr, "could not initialize `incoming'\n");
+    exit(1);
+  }
+
+  for (int i = MAX_SOUNDS - 1; i >= 0; --i) {
+    free_sound(&sounds[i]);
+  }
+  cut_clear();
 
   if (preload_flag) {
     file_preload_samples(sampleroot);
@@ -1316,11 +2568,6 @@ extern void audio_init(bool dirty_compressor, bool autoconnect, bool late_trigge
     exit(1);
   }
 
-#ifdef SEND_RMS
-  memset(rms, 0, sizeof(t_rms) * MAX_ORBIT * 2);
-  pthread_t rms_t;
-  pthread_create(&rms_t, NULL, (void*) thread_send_rms, NULL);
-#endif
 
 #ifdef JACK
   jack_init(autoconnect);
@@ -1331,27 +2578,69 @@ extern void audio_init(bool dirty_compressor, bool autoconnect, bool late_trigge
 #else
   pa_init();
 #endif
-  compression_speed = 1000 / g_samplerate;
+#ifdef SEND_RMS
+  // after the backend is up, as it may have changed the sample rate
+  int window = RMS_WINDOW * g_samplerate;
+  if (window < MAX_BLOCK) {
+    window = MAX_BLOCK;
+  }
+  for (int i = 0; i < MAX_ORBIT*2; ++i) {
+    rms[i].squares = calloc(window, sizeof(float));
+    if (!rms[i].squares) {
+      fprintf(stderr, "no memory to allocate rms window\n");
+      exit(1);
+    }
+  }
+  __atomic_store_n(&rms_window, window, __ATOMIC_RELEASE);
+  pthread_t rms_t;
+  pthread_create(&rms_t, NULL, (void*) thread_send_rms, NULL);
+#endif
+
+  // also after the backend is up, as the frames depend on the sample rate
+  if (prerender_ms > 0) {
+    prerender_frames = (int) ((double) prerender_ms * g_samplerate / 1000);
+    prerender_pool = thpool_init(num_render_workers > 0 ? num_render_workers : 1);
+    if (!prerender_pool) {
+      fprintf(stderr, "could not initialize `prerender_pool'\n");
+      exit(1);
+    }
+  }
+
   use_dirty_compressor = dirty_compressor;
   use_late_trigger = late_trigger;
   use_shape_gain_comp = shape_gain_comp;
 }
 
 extern void audio_close(void) {
-  if (delays) free(delays);
+  for (int orbit = 0; orbit < MAX_ORBIT; ++orbit) {
+    if (delays[orbit].lines) free(delays[orbit].lines);
+  }
+#ifdef SEND_RMS
+  for (int i = 0; i < MAX_ORBIT*2; ++i) {
+    if (rms[i].squares) free(rms[i].squares);
+  }
+#endif
   if (read_file_pool) thpool_destroy(read_file_pool);
-
-  // free all active sounds, if any
-  pthread_mutex_lock(&mutex_sounds);
+  if (prerender_pool) thpool_destroy(prerender_pool);
+  if (render_cache_pool) thpool_destroy(render_cache_pool);
+  if (render_cache) rendercache_destroy(render_cache);
+  if (render_pool) renderpool_destroy(render_pool);
+  if (buses) free(buses);
+  if (incoming) mpsc_destroy(incoming);
+  if (audio_clock) audioclock_destroy(audio_clock);
+  if (governor) governor_destroy(governor);
+
+  // free the effect state of all sounds that have played
   for (int i = 0; i < MAX_SOUNDS; ++i) {
-    if (sounds[i].active) {
-      free_vcf(&sounds[i]);
-      free_hpf(&sounds[i]);
-      free_bpf(&sounds[i]);
-      free_formant_history(&sounds[i]);
+    free_vcf(&sounds[i]);
+    free_hpf(&sounds[i]);
+    free_bpf(&sounds[i]);
+    free_crs(&sounds[i]);
+    if (sounds[i].prerender) {
+      free(sounds[i].prerender->samples);
+      free(sounds[i].prerender);
     }
   }
-  pthread_mutex_unlock(&mutex_sounds);
 }
 
 // Reset sound structure for reutilization
@@ -1359,68 +2648,40 @@ extern void audio_close(void) {
 // This clears structure except for pointer to arrays, to avoid the need of
 // reallocating them.
 static void reset_sound(t_sound* s) {
-  t_vcf *old_vcf = s->vcf;
-  t_vcf *old_hpf = s->hpf;
-  t_vcf *old_bpf = s->bpf;
-  double **old_formant_history = s->formant_history;
+  t_vcf *old_vcf = s->voice.vcf;
+  t_vcf *old_hpf = s->voice.hpf;
+  t_vcf *old_bpf = s->voice.bpf;
+  t_crs *old_coarsef = s->voice.coarsef;
+  t_prerender *old_prerender = s->prerender;
 
   memset(s, 0, sizeof(t_sound));
 
-  s->vcf = old_vcf;
-  s->hpf = old_hpf;
-  s->bpf = old_bpf;
-  s->formant_history = old_formant_history;
+  s->voice.vcf = old_vcf;
+  s->voice.hpf = old_hpf;
+  s->voice.bpf = old_bpf;
+  s->voice.coarsef = old_coarsef;
+  s->prerender = old_prerender;
 }
 
 /**/
 
 t_sound *new_sound() {
   t_sound *result = NULL;
-  t_sound *oldest = NULL;
-  int dying = 0;
-  int cull = playing_n >= MAX_PLAYING;
+  uint64_t head = __atomic_load_n(&sound_free_head, __ATOMIC_ACQUIRE);
+  uint64_t next;
 
-  pthread_mutex_lock(&mutex_sounds);
-  
-  for (int i = 0; i < MAX_SOUNDS; ++i) {
-    if (result == NULL && sounds[i].active == 0) {
-	result = &sounds[i];
+  do {
+    if ((uint32_t) head == NO_SOUND) {
+      return(NULL);
     }
+    next = (head & 0xffffffff00000000ull)
+      | __atomic_load_n(&sound_free_next[(uint32_t) head], __ATOMIC_RELAXED);
+  } while (!__atomic_compare_exchange_n(&sound_free_head, &head, next, true,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
 
-    if (cull && sounds[i].is_playing == 1) {
-      if ((sounds[i].end - sounds[i].position) > ROUNDOFF) {
-        if (oldest == NULL || oldest->startT > sounds[i].startT) {
-	  oldest = &sounds[i];
-	}
-      }
-      else {
-	dying++;
-      }
-    }
-  }
-
-  // printf("playing: %d dying: %d \n", playing_n, dying);
-  
-  // Treat MAX_PLAYING as a soft limit - those about to finish
-  // aren't counted.
-  if ((playing_n - dying) >= MAX_PLAYING) {
-    // printf("hit soft buffer, playing_n %d, dying %d, MAX_PLAYING %d(-%d)\n", playing_n, dying, MAX_PLAYING, MAX_PLAYING_SOFT_BUFFER);
-    if (oldest != NULL) {
-      // printf("culling sound with end %f, position %f, ROUNDOFF %d\n", oldest->end, oldest->position, ROUNDOFF);
-
-      // Rather than stop immediately, set it to finish in ROUNDOFF
-      // samples, so the envelope is applied thereby
-      // avoiding audio clicks.
-      oldest->end = oldest->position + ROUNDOFF;
-    }
-  }
-
-  if (result != NULL) {
-    reset_sound(result);
-    result->active = 1;
-  }
+  result = &sounds[(uint32_t) head];
+  reset_sound(result);
+  result->active = 1;
 
-  pthread_mutex_unlock(&mutex_sounds);
-  // printf("qs: playing %d waiting %d loading %d\n", queue_size(playing), queue_size(waiting), queue_size(loading));
   return(result);
 }
@@ -1,26 +1,33 @@
 #include "file.h"
 #include "config.h"
 #include "common.h"
+#include "governor.h"
+#include "kernels.h"
+#include "rendercache.h"
 
-#define MAXLINE  44100
 #define MAX_SOUNDS 512 // includes queue!
 
-// not a hard limit, after this number sounds will start being
-// culled (given ROUNDOFF samples to live to avoid
-// discontinuities).
+// default cap on the limit to how many sounds play at once. not a
+// hard limit, after this number sounds will start being culled (given
+// ROUNDOFF samples to live to avoid discontinuities), and the limit is
+// brought down from it under load.
 #define MAX_PLAYING 8
 
 #define ROUNDOFF 16
+
+// Sounds are rendered in blocks of at most this many frames, longer
+// periods are split up.
+#define MAX_BLOCK 256
 #define MAX_DB 12
 
 #ifdef JACK
 #include <jack/jack.h>
 #include "jack.h"
-#define sampletime_t jack_time_t
-#else
-#define sampletime_t double
 #endif
 
+// seconds since the epoch, by the wall clock
+#define sampletime_t double
+
 
 typedef struct {
  float cutoff;
@@ -47,14 +54,116 @@ typedef struct {
   float sum;
 } t_crs;
 
+#define FORMANT_TAPS 10
+
+// The last FORMANT_TAPS outputs of one channel's formant filter,
+// newest first from history[point]. Each is written twice, so they can
+// be read in one run without wrapping around.
+typedef struct {
+  double history[FORMANT_TAPS * 2];
+  int    point;
+} t_formant;
+
+// The lines of a delay, one for each output channel after another,
+// each a power of two long so positions wrap with a mask
 typedef struct {
-  float samples[MAXLINE];
-  int   point;
-} t_line;
+  unsigned int mask;
+  float samples[];
+} t_lines;
+
+// An orbit's delay. Its parameters are only changed by the audio
+// thread, as sounds sending to it start.
+typedef struct {
+  t_lines *lines;
+  unsigned int point;
+  // frames since anything was sent to it or came out above the silence
+  // threshold. once that's longer than the lines, its tail is over
+  unsigned int quiet;
+  float time;
+  float feedback;
+} t_delay;
+
+// the most effects a sound can have chained up
+#define MAX_EFFECTS 8
+
+struct t_node;
+
+// stages of a sound's attack/hold/release envelope
+enum {
+  ENV_NONE = -1,
+  ENV_ATTACK,
+  ENV_HOLD,
+  ENV_RELEASE,
+  ENV_DONE
+};
+
+// where one channel of a sound goes, and how loud
+typedef struct {
+  int   channel_a;
+  int   channel_b;
+  float gain_a;
+  float gain_b;
+} t_pan;
+
+struct t_voice;
+struct t_prerender;
 
-extern t_line* delays;
-extern float line_feedback_delay;
+// An effect, applied to a block of n values from one channel of a sound
+typedef void (*t_effect)(float *buf, int n, struct t_voice *voice, int channel);
 
+// The state touched while rendering a playing sound, packed into the
+// dense voices array on the audio thread. Everything else stays in the
+// t_sound it was triggered from.
+typedef struct t_voice {
+  int    offset; // frames to wait before starting
+  float  position;
+  float  speed;
+  float  accelerate;
+  float  start;
+  float  end;
+  float  given_end; // end before any cut or cull
+  float  gain;
+  float  delay;
+  int    reverse;
+  int    mono;
+  int    channels;
+  int    frames;
+  float  *items;
+  int    sample_loop;
+  int    env_stage;
+  int    env_frames;
+  double env_exp;
+  double env_mul;
+  float  attack;
+  float  hold;
+  float  release;
+  int    audible; // whether it's been above the silence threshold yet
+  int    quiet;   // frames it's been below the threshold since
+  int    interpolation;
+  rendercache_entry_t *cache; // its channels, if rendered before
+  struct t_prerender *pre;    // its first frames, if rendered ahead
+  int    played;              // frames of it played so far
+  t_pan  pans[2]; // only stereo sounds use both
+  int    effects_n;
+  t_effect effects[MAX_EFFECTS];
+  int    formant_vowelnum;
+  t_formant *formant;
+  t_vcf  *vcf;
+  t_vcf  *hpf;
+  t_vcf  *bpf;
+  int    coarse;
+  t_crs  *coarsef;
+  float  shape_k;
+  float  crush_scale;
+  sampletime_t startT;
+  int    cutgroup;
+  int    cut_continue;
+  t_sample *sample;
+  int    orbit;
+  struct t_node *sound;
+} t_voice;
+
+// A triggered sound, as parsed from OSC and queued until it is due
 typedef struct t_node {
   int    active;
   int    is_playing;
@@ -66,56 +175,45 @@ typedef struct t_node {
     t_loop *loop;
   };
   unsigned int loop_start;
-  int    channels;
-  float  *items;
   struct t_node *next, *prev;
-  float  position;
   float  speed;
-  int    reverse;
   float  pan;
   float  offset;
   float  start;
   float  end;
   float  velocity;
-  double  **formant_history;
   int    formant_vowelnum;
   float  cutoff;
   float  resonance;
-  t_vcf  *vcf;
   float  accelerate;
   int    shape;
   float  shape_k;
   int    kriole_chunk;
   int    is_kriole;
-  int    started;
-  int    checks;
   float  delay;
   float delaytime;
   float delayfeedback;
   float  gain;
   int    cutgroup;
-  int    mono;
   int    crush;
   float  crush_bits;
   int    coarse;
-  t_crs  *coarsef;
   float  hcutoff;
   float  hresonance;
-  t_vcf  *hpf;
   float  bandf;
   float  bandq;
-  t_vcf  *bpf;
   int    sample_loop;
-  int    cut_continue;
   char   unit;
   float  cps;
   double when;
   float  attack;
   float  hold;
   float  release;
-  float  playtime;
   int    orbit;
-  int    played;
+  int    interpolation; // INTERP_*, or less than 0 for the default
+  t_formant formant[2]; // only stereo sounds use both
+  struct t_prerender *prerender; // kept for reuse, like the effect state
+  t_voice voice;
 } t_sound;
 
 typedef struct {
@@ -153,18 +251,40 @@ typedef struct {
   float release;
 } t_play_args;
 
+// What the sounds on one orbit add up to over a block, before the
+// orbit's own effects
+typedef struct {
+  float out[MAX_CHANNELS][MAX_BLOCK];
+  // what's sent to the orbit's delay
+  float sends[MAX_CHANNELS][MAX_BLOCK];
+} t_orbit_bus;
+
+// A mix bus, for one thread's share of the sounds in a block. Only the
+// orbits with a bit set in orbits_used have been cleared and mixed
+// into, and of those only the ones set in sends_used have sends.
+typedef struct {
+  t_orbit_bus orbits[MAX_ORBIT];
+  unsigned int orbits_used;
+  unsigned int sends_used;
+  unsigned int block;
+} t_bus;
+
 #ifdef SEND_RMS
+// The squares of the last window frames of one channel of an orbit,
+// in a ring, and their running sum
 typedef struct {
-  int n;
-  float sum;
-  float squares[RMS_SZ];
-  float sum_of_squares;
+  double sum_of_squares;
+  // frames since the orbit was last played on
+  int quiet;
+  float *squares;
 } t_rms;
 #endif
 
 extern int audio_callback(int frames, float *input, float **outputs);
-extern void audio_init(bool dirty_compressor, bool autoconnect, bool late_trigger, unsigned int num_workers, char *sampleroot, bool shape_gain_comp, bool preload_flag);
+extern void audio_init(bool dirty_compressor, bool autoconnect, bool late_trigger, unsigned int num_workers, unsigned int num_render_workers, unsigned int max_playing, size_t render_cache_size, unsigned int prerender_ms, char *sampleroot, bool shape_gain_comp, bool preload_flag);
 extern void audio_close(void);
+extern void audio_stats(governor_stats_t *stats);
+extern unsigned long audio_merged(void);
 extern int audio_play(t_sound*);
 t_sound *new_sound();
 
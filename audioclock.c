@@ -0,0 +1,94 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+
+#include "audioclock.h"
+
+// errors bigger than this are taken as the clock having jumped, in
+// seconds
+#define MAX_ERROR 0.05
+
+struct audioclock {
+    double bandwidth;
+
+    // loop coefficients
+    double b;
+    double c;
+
+    // times are kept relative to where the loop last started, so
+    // they don't lose precision over a long run
+    double base;
+
+    // filtered start time of this period and the next
+    double t0;
+    double t1;
+    // filtered period length
+    double e2;
+
+    unsigned int frames;
+    // where the frame counter should be at the start of the next period
+    unsigned int next_frame;
+    bool locked;
+};
+
+audioclock_t* audioclock_init(double bandwidth) {
+    audioclock_t* c = calloc(1, sizeof(audioclock_t));
+    if (c == NULL) return NULL;
+
+    c->bandwidth = bandwidth;
+    c->locked = false;
+    return c;
+}
+
+// Starts the loop over from a period starting now
+static void reset(audioclock_t* c, unsigned int frames, double samplerate, double now) {
+    double omega = 2 * M_PI * c->bandwidth * frames / samplerate;
+
+    c->b = sqrt(2) * omega;
+    c->c = omega * omega;
+    c->e2 = frames / samplerate;
+    c->base = now;
+    c->t0 = 0;
+    c->t1 = c->e2;
+    c->frames = frames;
+    c->locked = true;
+}
+
+void audioclock_update(audioclock_t* c, unsigned int frame, unsigned int frames,
+                       double samplerate, double now) {
+    if (!c->locked || frames != c->frames || frame != c->next_frame) {
+        reset(c, frames, samplerate, now);
+    }
+    else {
+        double e = (now - c->base) - c->t1;
+
+        if (fabs(e) > MAX_ERROR) {
+            reset(c, frames, samplerate, now);
+        }
+        else {
+            c->t0 = c->t1;
+            c->t1 += c->b * e + c->e2;
+            c->e2 += c->c * e;
+        }
+    }
+    c->next_frame = frame + frames;
+}
+
+double audioclock_time(const audioclock_t* c) {
+    return c->base + c->t0;
+}
+
+double audioclock_frame_duration(const audioclock_t* c) {
+    return (c->t1 - c->t0) / c->frames;
+}
+
+double audioclock_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (double) ts.tv_sec + ((double) ts.tv_nsec / 1000000000.0);
+}
+
+void audioclock_destroy(audioclock_t* c) {
+    free(c);
+}
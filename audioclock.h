@@ -0,0 +1,38 @@
+#ifndef __AUDIOCLOCK_H__
+#define __AUDIOCLOCK_H__
+
+// Maps audio periods to wall clock time. Fed the wall clock time at
+// the start of each period, a delay-locked loop filters out the jitter
+// in when periods get processed, giving a steady estimate of when each
+// period's first frame is heard and how long a frame lasts. It starts
+// over if a period is dropped or comes in way off where it was
+// expected.
+
+typedef struct audioclock audioclock_t;
+
+// Initialize a clock with a loop of the given bandwidth in Hz
+//
+audioclock_t* audioclock_init(double bandwidth);
+
+// Feeds in the start of a period of frames frames, at position frame
+// of the device's frame counter, heard at wall clock time now
+//
+// Call this once per period, before reading the times for it.
+//
+void audioclock_update(audioclock_t* c, unsigned int frame, unsigned int frames,
+                       double samplerate, double now);
+
+// Wall clock time the first frame of the current period is heard, in
+// seconds
+double audioclock_time(const audioclock_t* c);
+
+// How long one frame of the current period lasts, in seconds
+double audioclock_frame_duration(const audioclock_t* c);
+
+// Reads the wall clock, in seconds since the epoch
+double audioclock_now(void);
+
+// De-allocates the clock
+void audioclock_destroy(audioclock_t* c);
+
+#endif
@@ -4,3 +4,9 @@
 int g_num_channels = DEFAULT_CHANNELS;
 float g_gain = DEFAULT_GAIN;
 int g_samplerate = DEFAULT_SAMPLERATE;
+// as an amplitude, zero for never
+float g_silence = 0;
+int g_interpolation = DEFAULT_INTERPOLATION;
+// whether samples are played at their own rate, rather than
+// resampled as they load
+bool g_native_rate = false;
@@ -8,5 +8,8 @@
 extern int g_num_channels;
 extern float g_gain;
 extern int g_samplerate;
+extern float g_silence;
+extern int g_interpolation;
+extern bool g_native_rate;
 
 #endif // __COMMON_H__
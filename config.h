@@ -1,6 +1,8 @@
 #ifndef _DIRTCONFIGH_
 #define _DIRTCONFIGH_
 
+#include <math.h>
+
 //#define FEEDBACK
 //#define INPUT
 #define DEFAULT_OSC_PORT "7771"
@@ -14,7 +16,33 @@
 #define MIN_SAMPLERATE 1024
 #define MAX_SAMPLERATE 128000
 
+// sounds that stay below this level, in dB, for SILENCE_TIME seconds
+// are stopped early. off by default (-inf), as it would also stop
+// samples with a pause partway through
+#define DEFAULT_SILENCE (-INFINITY)
+#define SILENCE_TIME 0.2
+
+// how sounds are interpolated unless they say otherwise, one of the
+// INTERP_ qualities in kernels.h (0 is linear)
+#define DEFAULT_INTERPOLATION 0
+
 #define DEFAULT_WORKERS 2
+#define DEFAULT_RENDER_WORKERS 0
+#define MAX_RENDER_WORKERS 64
+
+// megabytes of rendered sounds to keep, to play again rather than
+// render them each time. 0 turns the cache off
+#define DEFAULT_RENDER_CACHE 0
+#define MAX_RENDER_CACHE 4096
+
+// milliseconds of each sound to render on worker threads while it waits
+// to start. 0 renders everything as it plays
+#define DEFAULT_PRERENDER 0
+#define MAX_PRERENDER 1000
+
+// how quickly the mapping of audio periods to wall clock time follows
+// changes in their timing, in Hz. lower smooths out more jitter
+#define CLOCK_BANDWIDTH 0.5
 
 // Brings it into being roughly equivalent to superdirt
 #define CUTOFFRATIO 30000.0f
@@ -24,8 +52,8 @@
 #define MAX_ORBIT 15
 
 #ifdef SEND_RMS
-// 300ms assuming 44100
-#define RMS_SZ 13230
+// length of the rms meters' window, in seconds
+#define RMS_WINDOW 0.3
 #endif
 
 #endif
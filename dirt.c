@@ -20,6 +20,9 @@ static int jack_auto_connect_flag = 1;
 static int late_trigger_flag = 1;
 static int shape_gain_comp_flag = 0;
 static int preload_flag = 0;
+static int native_rate_flag = 0;
+
+static const char *interpolation_names[INTERP_QUALITIES] = {"linear", "cubic", "sinc"};
 
 #ifdef linux
 void sigint_handler(int sig) {
@@ -36,15 +39,22 @@ int main (int argc, char **argv) {
   int num_channels;
   int samplerate;
   float gain = 20.0 * log10(g_gain/16.0);
+  float silence = DEFAULT_SILENCE;
   char *osc_port = DEFAULT_OSC_PORT;
   char *sampleroot = "./samples";
   char *version = "1.0.0";
 
   unsigned int num_workers = DEFAULT_WORKERS;
+  unsigned int num_render_workers = DEFAULT_RENDER_WORKERS;
+  unsigned int max_playing = MAX_PLAYING;
+  unsigned int render_cache = DEFAULT_RENDER_CACHE;
+  unsigned int prerender = DEFAULT_PRERENDER;
 
 #ifdef linux
   signal(SIGINT, sigint_handler);
 #endif
+
+  g_silence = pow(10.0, silence/20.0);
   
   while (1)
   {
@@ -68,11 +78,19 @@ int main (int argc, char **argv) {
       {"no-late-trigger",       no_argument, &late_trigger_flag, 0},
       {"samples-root-path",     required_argument, 0, 's'},
       {"workers",               required_argument, 0, 'w'},
+      {"render-workers",        required_argument, 0, 'W'},
+      {"max-playing",           required_argument, 0, 'P'},
+      {"render-cache",          required_argument, 0, 'C'},
+      {"prerender",             required_argument, 0, 'R'},
 
       {"gain",                  required_argument, 0, 'g'},
+      {"silence-threshold",     required_argument, 0, 'S'},
+      {"interpolation",         required_argument, 0, 'i'},
 
       {"preload",               no_argument, &preload_flag, 1},
       {"no-preload",            no_argument, &preload_flag, 0},
+      {"native-rate",           no_argument, &native_rate_flag, 1},
+      {"no-native-rate",        no_argument, &native_rate_flag, 0},
 
       {"version", no_argument, 0, 'v'},
       {"help",    no_argument, 0, 'h'},
@@ -87,7 +105,7 @@ int main (int argc, char **argv) {
       required_argument: ":"
       optional_argument: "::" */
 
-    c = getopt_long(argc, argv, "c:s:w:g:vh",
+    c = getopt_long(argc, argv, "c:s:w:W:g:vh",
                     long_options, &option_index);
 
     if (c == -1)
@@ -119,6 +137,10 @@ int main (int argc, char **argv) {
                "      --shape-gain-compensation    enable distortion gain compensation\n"
                "      --no-shape-gain-compensation disable distortion gain compensation (default)\n"
                "  -g, --gain                       gain adjustment (default %f db)\n"
+               "      --silence-threshold          level in db below which sounds are stopped early, off\n"
+               "                                   unless set, as it also stops samples with pauses in\n"
+               "      --interpolation              linear, cubic (under twice the cost) or sinc (four times\n"
+               "                                   or more), unless sounds say otherwise (default: %s)\n"
 #ifdef JACK
                "      --jack-auto-connect          automatically connect to writable clients (default)\n"
                "      --no-jack-auto-connect       do not connect to writable clients  \n"
@@ -127,8 +149,19 @@ int main (int argc, char **argv) {
                "      --no-late-trigger            disable sample retrigger after loading\n"
                "      --preload                    enable sample preloading at startup\n"
                "      --no-preload                 disable sample preloading at startup (default)\n"
+               "      --native-rate                play samples at their own rate, interpolating as they\n"
+               "                                   play rather than resampling them as they load\n"
+               "      --no-native-rate             resample samples to the output rate as they load (default)\n"
 	             "  -s  --samples-root-path          set a samples root directory path\n"
                "  -w, --workers                    number of sample-reading workers (default: %u)\n"
+               "  -W, --render-workers             number of extra threads to render sounds on, 0 renders\n"
+               "                                   everything on the audio thread (default: %u)\n"
+               "      --max-playing                most sounds to play at once, fewer if rendering them\n"
+               "                                   takes too long (default: %u)\n"
+               "      --render-cache               megabytes of rendered sounds to keep and play again\n"
+               "                                   when they're triggered the same way, 0 is off (default: %u)\n"
+               "      --prerender                  milliseconds of each sound to render ahead on the render\n"
+               "                                   workers (or one thread) while it waits, 0 is off (default: %u)\n"
                "  -h, --help                       display this help and exit\n"
                "  -v, --version                    output version information and exit\n",
                DEFAULT_OSC_PORT, DEFAULT_CHANNELS,
@@ -136,7 +169,12 @@ int main (int argc, char **argv) {
 	       DEFAULT_SAMPLERATE,
 #endif
                20.0*log10(DEFAULT_GAIN/16.0),
-               DEFAULT_WORKERS);
+               interpolation_names[DEFAULT_INTERPOLATION],
+               DEFAULT_WORKERS,
+               DEFAULT_RENDER_WORKERS,
+               MAX_PLAYING,
+               DEFAULT_RENDER_CACHE,
+               DEFAULT_PRERENDER);
         return 1;
 
       case 'p':
@@ -168,6 +206,34 @@ int main (int argc, char **argv) {
           num_workers = DEFAULT_WORKERS;
         }
         break;
+      case 'W':
+        num_render_workers = atoi(optarg);
+        if (num_render_workers > MAX_RENDER_WORKERS) {
+          fprintf(stderr, "invalid number of render workers: %u (max: %u). resetting to default\n", num_render_workers, MAX_RENDER_WORKERS);
+          num_render_workers = DEFAULT_RENDER_WORKERS;
+        }
+        break;
+      case 'P':
+        max_playing = atoi(optarg);
+        if (max_playing < 1 || max_playing > MAX_SOUNDS) {
+          fprintf(stderr, "invalid number of sounds to play at once: %u (min: 1, max: %u). resetting to default\n", max_playing, MAX_SOUNDS);
+          max_playing = MAX_PLAYING;
+        }
+        break;
+      case 'C':
+        render_cache = atoi(optarg);
+        if (render_cache > MAX_RENDER_CACHE) {
+          fprintf(stderr, "invalid render cache size: %u (max: %u). resetting to default\n", render_cache, MAX_RENDER_CACHE);
+          render_cache = DEFAULT_RENDER_CACHE;
+        }
+        break;
+      case 'R':
+        prerender = atoi(optarg);
+        if (prerender > MAX_PRERENDER) {
+          fprintf(stderr, "invalid prerender time: %u (max: %u). resetting to default\n", prerender, MAX_PRERENDER);
+          prerender = DEFAULT_PRERENDER;
+        }
+        break;
       
       case 'g':
         gain = atof(optarg);
@@ -176,6 +242,25 @@ int main (int argc, char **argv) {
         g_gain = 16.0 * pow(10.0, gain/20.0);
         break;
 
+      case 'i':
+        g_interpolation = -1;
+        for (int i = 0; i < INTERP_QUALITIES; ++i) {
+          if (strcmp(optarg, interpolation_names[i]) == 0) {
+            g_interpolation = i;
+          }
+        }
+        if (g_interpolation < 0) {
+          fprintf(stderr, "invalid interpolation: %s. resetting to default\n", optarg);
+          g_interpolation = DEFAULT_INTERPOLATION;
+        }
+        break;
+
+      case 'S':
+        silence = atof(optarg);
+        silence = (silence > 0)? 0 : silence;
+        g_silence = pow(10.0, silence/20.0);
+        break;
+
       case '?':
         /* getopt_long will have already printed an error */
         break;
@@ -190,6 +275,8 @@ int main (int argc, char **argv) {
   fprintf(stderr, "samplerate: %u\n", g_samplerate);
   fprintf(stderr, "gain (dB): %f\n", gain);
   fprintf(stderr, "gain factor: %f\n", g_gain);
+  fprintf(stderr, "silence threshold (dB): %f\n", silence);
+  fprintf(stderr, "interpolation: %s\n", interpolation_names[g_interpolation]);
 
   if (!dirty_compressor_flag) {
     fprintf(stderr, "dirty compressor disabled\n");
@@ -211,14 +298,26 @@ int main (int argc, char **argv) {
     if (preload_flag) {
     fprintf(stderr, "sample preloading enabled\n");
   }
+  if (native_rate_flag) {
+    fprintf(stderr, "samples play at their native rate\n");
+  }
+  g_native_rate = native_rate_flag;
 
   fprintf(stderr, "workers: %u\n", num_workers);
+  fprintf(stderr, "render workers: %u\n", num_render_workers);
+  fprintf(stderr, "max playing: %u\n", max_playing);
+  if (render_cache > 0) {
+    fprintf(stderr, "render cache (MB): %u\n", render_cache);
+  }
+  if (prerender > 0) {
+    fprintf(stderr, "prerender (ms): %u\n", prerender);
+  }
 
   fprintf(stderr, "init audio\n");
 #ifdef JACK
-  audio_init(dirty_compressor_flag, jack_auto_connect_flag, late_trigger_flag, num_workers, sampleroot, shape_gain_comp_flag, preload_flag);
+  audio_init(dirty_compressor_flag, jack_auto_connect_flag, late_trigger_flag, num_workers, num_render_workers, max_playing, (size_t) render_cache << 20, prerender, sampleroot, shape_gain_comp_flag, preload_flag);
 #else
-  audio_init(dirty_compressor_flag, true, late_trigger_flag, num_workers, sampleroot, shape_gain_comp_flag, preload_flag);
+  audio_init(dirty_compressor_flag, true, late_trigger_flag, num_workers, num_render_workers, max_playing, (size_t) render_cache << 20, prerender, sampleroot, shape_gain_comp_flag, preload_flag);
 #endif
 
   fprintf(stderr, "init open sound control\n");
@@ -0,0 +1,100 @@
+#include <math.h>
+#include <string.h>
+
+#include "dynamics.h"
+#include "kernels.h"
+
+// longer runs are done in pieces this long
+#define DYNAMICS_BLOCK 256
+
+void dynamics_init(t_dynamics *d, int mode, float gain) {
+  memset(d, 0, sizeof(t_dynamics));
+  d->mode = mode;
+  d->gain = gain;
+}
+
+// Works out the dirty compressor's gain for each frame. The envelope
+// creeps up by 50 per second and is pulled back whenever it would take
+// the loudest channel over 1.
+
+static void dirty_amp(t_dynamics *d, float **buffers, int channels,
+                      int frames, float gain, int samplerate, float *amp) {
+  float peak[DYNAMICS_BLOCK];
+  float step = (float) 50 / samplerate;
+  float env = d->env;
+
+  memset(peak, 0, sizeof(float) * frames);
+  for (int channel = 0; channel < channels; ++channel) {
+    const float *buf = buffers[channel];
+    for (int i = 0; i < frames; ++i) {
+      float value = fabsf(buf[i]);
+      peak[i] = (value > peak[i]) ? value : peak[i];
+    }
+  }
+
+  for (int i = 0; i < frames; ++i) {
+    env += step;
+    if (peak[i] * env > 1) {
+      env = env / (peak[i] * env);
+    }
+    amp[i] = env * gain / 5.0f;
+  }
+  d->env = env;
+}
+
+static void run(t_dynamics *d, float **buffers, int channels, int frames,
+                float gain, int samplerate) {
+  float amp[DYNAMICS_BLOCK];
+
+  if (d->mode == DYNAMICS_DIRTY) {
+    dirty_amp(d, buffers, channels, frames, gain, samplerate, amp);
+  }
+  else if (gain != d->gain) {
+    for (int i = 0; i < frames; ++i) {
+      amp[i] = d->gain + (gain - d->gain) * (float) (i + 1) / frames;
+    }
+  }
+  else {
+    for (int channel = 0; channel < channels; ++channel) {
+      float *buf = buffers[channel];
+      for (int i = 0; i < frames; ++i) {
+        buf[i] *= gain;
+      }
+    }
+    return;
+  }
+
+  for (int channel = 0; channel < channels; ++channel) {
+    kernels.gain(buffers[channel], amp, frames);
+  }
+  d->gain = gain;
+}
+
+void dynamics_run(t_dynamics *d, float **buffers, int offset, int channels,
+                  int frames, float gain, int samplerate) {
+  float *bufs[channels];
+
+  for (int i = 0; i < frames; i += DYNAMICS_BLOCK) {
+    int n = (frames - i < DYNAMICS_BLOCK) ? frames - i : DYNAMICS_BLOCK;
+
+    for (int channel = 0; channel < channels; ++channel) {
+      bufs[channel] = buffers[channel] + offset + i;
+    }
+    run(d, bufs, channels, n, gain, samplerate);
+  }
+}
+
+void dynamics_silence(t_dynamics *d, int frames, float gain, int samplerate) {
+  if (d->mode == DYNAMICS_DIRTY) {
+    // the envelope creeps up just as it would over silence, one step
+    // at a time so it's rounded the same
+    float step = (float) 50 / samplerate;
+    float env = d->env;
+
+    for (int i = 0; i < frames; ++i) {
+      env += step;
+    }
+    d->env = env;
+  }
+  d->gain = gain;
+}
@@ -0,0 +1,37 @@
+#ifndef __DYNAMICS_H__
+#define __DYNAMICS_H__
+
+// Dynamics processing for a bus, a block at a time. Each instance
+// keeps its own state, so any number of buses can have one.
+
+enum {
+  // just the gain, ramped when it changes
+  DYNAMICS_GAIN,
+  // the peak limiting compressor of --dirty-compressor
+  DYNAMICS_DIRTY
+};
+
+typedef struct {
+  int   mode;
+  // gain applied at the end of the last block
+  float gain;
+  // envelope of the dirty compressor
+  float env;
+} t_dynamics;
+
+// Initialize an instance in the given mode, starting at the given
+// gain
+void dynamics_init(t_dynamics *d, int mode, float gain);
+
+// Applies the dynamics to frames frames of channels channels, from
+// offset into each buffer. A change in gain is ramped over the block.
+//
+void dynamics_run(t_dynamics *d, float **buffers, int offset, int channels,
+                  int frames, float gain, int samplerate);
+
+// Accounts for frames frames of silence going by, without having to
+// run them through
+//
+void dynamics_silence(t_dynamics *d, int frames, float gain, int samplerate);
+
+#endif
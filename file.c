@@ -182,8 +182,10 @@ extern t_sample *file_get(char *samplename, const char *sampleroot) {
       sf_close(sndfile);
     }
 
-    if (sample) {
+    if (sample && !g_native_rate) {
       fix_samplerate(sample);
+    }
+    if (sample) {
       sample->onsets = NULL;
       //sample->onsets = segment_get_onsets(sample);
     }
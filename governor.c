@@ -0,0 +1,142 @@
+#include <stdlib.h>
+#include <time.h>
+
+#include "governor.h"
+
+// number of periods the percentile is taken over
+#define WINDOW 128
+// which percentile
+#define PERCENTILE 0.95
+// render time is counted in steps of 1% of the period, up to twice
+// the period
+#define BINS 200
+
+// above this fraction of the period the limit comes down, below the
+// other it's allowed up again
+#define HIGH_LOAD 0.7
+#define LOW_LOAD 0.5
+
+// periods to wait after changing the limit before changing it again,
+// so the window can catch up
+#define HOLDOFF 32
+
+#define MIN_LIMIT 1
+
+struct governor {
+    unsigned int cap;
+    unsigned int limit;
+    unsigned int playing;
+
+    struct timespec started;
+
+    // the bins of the last WINDOW periods, oldest first from point,
+    // and how many periods fell into each bin
+    unsigned short window[WINDOW];
+    unsigned int point;
+    unsigned int counts[BINS];
+
+    unsigned int holdoff;
+    // whether the limit has been reached since it last changed
+    int pressed;
+
+    float load;
+    unsigned long culled[CULL_REASONS];
+};
+
+governor_t* governor_init(unsigned int cap) {
+    governor_t* g = calloc(1, sizeof(governor_t));
+    if (g == NULL) return NULL;
+
+    g->cap = (cap < MIN_LIMIT) ? MIN_LIMIT : cap;
+    g->limit = g->cap;
+    // the window starts out as idle periods
+    g->counts[0] = WINDOW;
+    return g;
+}
+
+void governor_start(governor_t* g) {
+    clock_gettime(CLOCK_MONOTONIC, &g->started);
+}
+
+// The bin at or below which the percentile of the window falls
+static unsigned int percentile(const governor_t* g) {
+    unsigned int above = 0;
+    unsigned int bin = BINS - 1;
+
+    while (bin > 0) {
+        above += g->counts[bin];
+        if (above > WINDOW * (1 - PERCENTILE)) break;
+        --bin;
+    }
+    return bin;
+}
+
+void governor_finish(governor_t* g, double period, unsigned int playing) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    double taken = (double) (now.tv_sec - g->started.tv_sec)
+        + (double) (now.tv_nsec - g->started.tv_nsec) / 1000000000.0;
+    int bin = (period > 0) ? (int) (taken / period * 100) : 0;
+    if (bin < 0) bin = 0;
+    if (bin >= BINS) bin = BINS - 1;
+
+    g->counts[g->window[g->point]]--;
+    g->window[g->point] = bin;
+    g->counts[bin]++;
+    g->point = (g->point + 1) % WINDOW;
+
+    float load = percentile(g) / 100.0f;
+    __atomic_store(&g->load, &load, __ATOMIC_RELAXED);
+    __atomic_store_n(&g->playing, playing, __ATOMIC_RELAXED);
+
+    if (playing >= g->limit) {
+        g->pressed = 1;
+    }
+    if (g->holdoff > 0) {
+        g->holdoff--;
+        return;
+    }
+
+    unsigned int limit = g->limit;
+    if (load > HIGH_LOAD && limit > MIN_LIMIT) {
+        // come down quickly, in proportion to how far over it is
+        unsigned int step = limit / 8;
+        limit -= (step < 1) ? 1 : step;
+        if (limit < MIN_LIMIT) limit = MIN_LIMIT;
+    }
+    else if (load < LOW_LOAD && g->pressed && limit < g->cap) {
+        // and go back up a sound at a time, only if it's wanted
+        limit++;
+    }
+    else {
+        return;
+    }
+
+    __atomic_store_n(&g->limit, limit, __ATOMIC_RELAXED);
+    g->holdoff = HOLDOFF;
+    g->pressed = 0;
+}
+
+unsigned int governor_limit(const governor_t* g) {
+    return g->limit;
+}
+
+void governor_culled(governor_t* g) {
+    int reason = (g->limit < g->cap) ? CULL_LOAD : CULL_CAP;
+    __atomic_store_n(&g->culled[reason], g->culled[reason] + 1, __ATOMIC_RELAXED);
+}
+
+void governor_stats(const governor_t* g, governor_stats_t* stats) {
+    stats->limit = __atomic_load_n(&g->limit, __ATOMIC_RELAXED);
+    stats->cap = g->cap;
+    stats->playing = __atomic_load_n(&g->playing, __ATOMIC_RELAXED);
+    __atomic_load(&g->load, &stats->load, __ATOMIC_RELAXED);
+    for (int i = 0; i < CULL_REASONS; ++i) {
+        stats->culled[i] = __atomic_load_n(&g->culled[i], __ATOMIC_RELAXED);
+    }
+}
+
+void governor_destroy(governor_t* g) {
+    free(g);
+}
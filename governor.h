@@ -0,0 +1,62 @@
+#ifndef __GOVERNOR_H__
+#define __GOVERNOR_H__
+
+// Adapts the soft limit on how many sounds play at once to how much
+// of each period's deadline rendering takes. The time taken is kept
+// over a window of recent periods, and when a high percentile of it
+// gets too close to the deadline the limit is brought down, then let
+// back up towards its cap once there's room again.
+//
+// Everything but governor_stats() is to be called from the audio
+// thread.
+
+typedef struct governor governor_t;
+
+// why sounds were culled to keep to the limit
+enum {
+    // there were more than the cap
+    CULL_CAP,
+    // the limit had been brought down below the cap
+    CULL_LOAD,
+    CULL_REASONS
+};
+
+typedef struct {
+    // the limit now, and the most it can go up to
+    unsigned int limit;
+    unsigned int cap;
+    // sounds playing at the end of the last period
+    unsigned int playing;
+    // percentile of render time over the window, as a fraction of
+    // the period
+    float load;
+    unsigned long culled[CULL_REASONS];
+} governor_stats_t;
+
+// Initialize a governor with a limit of at most cap sounds
+//
+governor_t* governor_init(unsigned int cap);
+
+// Marks the start of rendering a period
+void governor_start(governor_t* g);
+
+// Marks the end of rendering a period lasting period seconds, with
+// playing sounds still going, and adjusts the limit
+//
+void governor_finish(governor_t* g, double period, unsigned int playing);
+
+// Return the current limit
+unsigned int governor_limit(const governor_t* g);
+
+// Counts a sound culled to keep to the limit
+void governor_culled(governor_t* g);
+
+// Copies out the current figures. Safe to call from any thread, though
+// they may be from either side of a period.
+//
+void governor_stats(const governor_t* g, governor_stats_t* stats);
+
+// De-allocates the governor
+void governor_destroy(governor_t* g);
+
+#endif
@@ -0,0 +1,365 @@
+#include <string.h>
+#include <math.h>
+
+#include "kernels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KERNELS_X86
+#include <immintrin.h>
+#endif
+
+static void fetch_scalar(float *out, const float *items, const int *index,
+                         const int *next, const float *tween, int n) {
+  for (int i = 0; i < n; ++i) {
+    float value = items[index[i]];
+    out[i] = value + (items[next[i]] - value) * tween[i];
+  }
+}
+
+// The sinc kernel's coefficients, for each octave a row of taps for
+// each of SINC_PHASES + 1 evenly spaced points between one frame and
+// the next. Points in between take a mix of the rows either side.
+
+#define SINC_PHASES 256
+
+static float sinc_table_0[(SINC_PHASES + 1) * (SINC_TAPS << 0)];
+static float sinc_table_1[(SINC_PHASES + 1) * (SINC_TAPS << 1)];
+static float sinc_table_2[(SINC_PHASES + 1) * (SINC_TAPS << 2)];
+static float sinc_table_3[(SINC_PHASES + 1) * (SINC_TAPS << 3)];
+
+static float *sinc_tables[SINC_OCTAVES] = {
+  sinc_table_0, sinc_table_1, sinc_table_2, sinc_table_3
+};
+
+static inline int clamp_index(int index, int lo, int hi) {
+  return (index < lo) ? lo : (index > hi) ? hi : index;
+}
+
+static void fetch_cubic_scalar(float *out, const float *items, const int *index,
+                               int stride, int lo, int hi, const float *tween,
+                               int n) {
+  for (int i = 0; i < n; ++i) {
+    float ym1 = items[clamp_index(index[i] - stride, lo, hi)];
+    float y0 = items[clamp_index(index[i], lo, hi)];
+    float y1 = items[clamp_index(index[i] + stride, lo, hi)];
+    float y2 = items[clamp_index(index[i] + 2 * stride, lo, hi)];
+    float t = tween[i];
+
+    float c1 = 0.5f * (y1 - ym1);
+    float c2 = ym1 - 2.5f * y0 + 2.0f * y1 - 0.5f * y2;
+    float c3 = 0.5f * (y2 - ym1) + 1.5f * (y0 - y1);
+    out[i] = ((c3 * t + c2) * t + c1) * t + y0;
+  }
+}
+
+static void fetch_sinc_scalar(float *out, const float *items, const int *index,
+                              int stride, int lo, int hi, const float *tween,
+                              int n, int octave) {
+  int taps = SINC_TAPS << octave;
+  const float *table = sinc_tables[octave];
+
+  for (int i = 0; i < n; ++i) {
+    float point = tween[i] * SINC_PHASES;
+    int phase = (int) point;
+    float frac = point - (float) phase;
+    const float *a = table + phase * taps;
+    const float *b = a + taps;
+    int first = index[i] - (taps / 2 - 1) * stride;
+    float sum = 0;
+
+    for (int k = 0; k < taps; ++k) {
+      float c = a[k] + (b[k] - a[k]) * frac;
+      sum += items[clamp_index(first + k * stride, lo, hi)] * c;
+    }
+    out[i] = sum;
+  }
+}
+
+static void gain_scalar(float *buf, const float *amp, int n) {
+  for (int i = 0; i < n; ++i) {
+    buf[i] *= amp[i];
+  }
+}
+
+static void pan_scalar(float *out_a, float *out_b, const float *in,
+                       float gain_a, float gain_b, int n) {
+  for (int i = 0; i < n; ++i) {
+    out_a[i] += in[i] * gain_a;
+    out_b[i] += in[i] * gain_b;
+  }
+}
+
+#ifdef KERNELS_X86
+
+// no gather before AVX2, so the loads are scalar and only the
+// arithmetic is vectorised
+
+__attribute__((target("sse2")))
+static void fetch_sse2(float *out, const float *items, const int *index,
+                       const int *next, const float *tween, int n) {
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128 a = _mm_setr_ps(items[index[i]], items[index[i+1]],
+                           items[index[i+2]], items[index[i+3]]);
+    __m128 b = _mm_setr_ps(items[next[i]], items[next[i+1]],
+                           items[next[i+2]], items[next[i+3]]);
+    __m128 t = _mm_loadu_ps(tween + i);
+    _mm_storeu_ps(out + i, _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t)));
+  }
+  fetch_scalar(out + i, items, index + i, next + i, tween + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void fetch_cubic_sse2(float *out, const float *items, const int *index,
+                             int stride, int lo, int hi, const float *tween,
+                             int n) {
+  const __m128 half = _mm_set1_ps(0.5f);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128 y[4];
+    for (int k = 0; k < 4; ++k) {
+      int offset = (k - 1) * stride;
+      y[k] = _mm_setr_ps(items[clamp_index(index[i] + offset, lo, hi)],
+                         items[clamp_index(index[i+1] + offset, lo, hi)],
+                         items[clamp_index(index[i+2] + offset, lo, hi)],
+                         items[clamp_index(index[i+3] + offset, lo, hi)]);
+    }
+    __m128 t = _mm_loadu_ps(tween + i);
+    __m128 c1 = _mm_mul_ps(half, _mm_sub_ps(y[2], y[0]));
+    __m128 c2 = _mm_sub_ps(_mm_add_ps(_mm_sub_ps(y[0], _mm_mul_ps(_mm_set1_ps(2.5f), y[1])),
+                                      _mm_mul_ps(_mm_set1_ps(2.0f), y[2])),
+                           _mm_mul_ps(half, y[3]));
+    __m128 c3 = _mm_add_ps(_mm_mul_ps(half, _mm_sub_ps(y[3], y[0])),
+                           _mm_mul_ps(_mm_set1_ps(1.5f), _mm_sub_ps(y[1], y[2])));
+    __m128 v = _mm_add_ps(_mm_mul_ps(c3, t), c2);
+    v = _mm_add_ps(_mm_mul_ps(v, t), c1);
+    _mm_storeu_ps(out + i, _mm_add_ps(_mm_mul_ps(v, t), y[1]));
+  }
+  fetch_cubic_scalar(out + i, items, index + i, stride, lo, hi, tween + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void fetch_sinc_sse2(float *out, const float *items, const int *index,
+                            int stride, int lo, int hi, const float *tween,
+                            int n, int octave) {
+  int taps = SINC_TAPS << octave;
+  const float *table = sinc_tables[octave];
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128 point = _mm_mul_ps(_mm_loadu_ps(tween + i), _mm_set1_ps(SINC_PHASES));
+    __m128i phase = _mm_cvttps_epi32(point);
+    __m128 frac = _mm_sub_ps(point, _mm_cvtepi32_ps(phase));
+    int phases[4], first[4];
+    __m128 sum = _mm_setzero_ps();
+
+    _mm_storeu_si128((__m128i *) phases, phase);
+    for (int j = 0; j < 4; ++j) {
+      phases[j] *= taps;
+      first[j] = index[i+j] - (taps / 2 - 1) * stride;
+    }
+    for (int k = 0; k < taps; ++k) {
+      const float *a = table + k;
+      const float *b = a + taps;
+      int offset = k * stride;
+      __m128 ca = _mm_setr_ps(a[phases[0]], a[phases[1]], a[phases[2]], a[phases[3]]);
+      __m128 cb = _mm_setr_ps(b[phases[0]], b[phases[1]], b[phases[2]], b[phases[3]]);
+      __m128 c = _mm_add_ps(ca, _mm_mul_ps(_mm_sub_ps(cb, ca), frac));
+      __m128 x = _mm_setr_ps(items[clamp_index(first[0] + offset, lo, hi)],
+                             items[clamp_index(first[1] + offset, lo, hi)],
+                             items[clamp_index(first[2] + offset, lo, hi)],
+                             items[clamp_index(first[3] + offset, lo, hi)]);
+      sum = _mm_add_ps(sum, _mm_mul_ps(x, c));
+    }
+    _mm_storeu_ps(out + i, sum);
+  }
+  fetch_sinc_scalar(out + i, items, index + i, stride, lo, hi, tween + i, n - i, octave);
+}
+
+__attribute__((target("sse2")))
+static void gain_sse2(float *buf, const float *amp, int n) {
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    _mm_storeu_ps(buf + i, _mm_mul_ps(_mm_loadu_ps(buf + i),
+                                      _mm_loadu_ps(amp + i)));
+  }
+  gain_scalar(buf + i, amp + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void pan_sse2(float *out_a, float *out_b, const float *in,
+                     float gain_a, float gain_b, int n) {
+  __m128 ga = _mm_set1_ps(gain_a);
+  __m128 gb = _mm_set1_ps(gain_b);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128 v = _mm_loadu_ps(in + i);
+    _mm_storeu_ps(out_a + i, _mm_add_ps(_mm_loadu_ps(out_a + i),
+                                        _mm_mul_ps(v, ga)));
+    _mm_storeu_ps(out_b + i, _mm_add_ps(_mm_loadu_ps(out_b + i),
+                                        _mm_mul_ps(v, gb)));
+  }
+  pan_scalar(out_a + i, out_b + i, in + i, gain_a, gain_b, n - i);
+}
+
+// FMA is left alone so results match the other kernels bit for bit
+
+__attribute__((target("avx2")))
+static void fetch_avx2(float *out, const float *items, const int *index,
+                       const int *next, const float *tween, int n) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 a = _mm256_i32gather_ps(items,
+                                   _mm256_loadu_si256((const __m256i *) (index + i)), 4);
+    __m256 b = _mm256_i32gather_ps(items,
+                                   _mm256_loadu_si256((const __m256i *) (next + i)), 4);
+    __m256 t = _mm256_loadu_ps(tween + i);
+    _mm256_storeu_ps(out + i,
+                     _mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(b, a), t)));
+  }
+  fetch_scalar(out + i, items, index + i, next + i, tween + i, n - i);
+}
+
+// gathers the values at offsets index + offset into items, with the
+// offsets clamped to lo and hi
+__attribute__((target("avx2")))
+static inline __m256 gather_clamped(const float *items, __m256i index, int offset,
+                                    __m256i lo, __m256i hi) {
+  __m256i at = _mm256_add_epi32(index, _mm256_set1_epi32(offset));
+  at = _mm256_min_epi32(_mm256_max_epi32(at, lo), hi);
+  return _mm256_i32gather_ps(items, at, 4);
+}
+
+__attribute__((target("avx2")))
+static void fetch_cubic_avx2(float *out, const float *items, const int *index,
+                             int stride, int lo, int hi, const float *tween,
+                             int n) {
+  const __m256 half = _mm256_set1_ps(0.5f);
+  const __m256i vlo = _mm256_set1_epi32(lo);
+  const __m256i vhi = _mm256_set1_epi32(hi);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i at = _mm256_loadu_si256((const __m256i *) (index + i));
+    __m256 ym1 = gather_clamped(items, at, -stride, vlo, vhi);
+    __m256 y0 = gather_clamped(items, at, 0, vlo, vhi);
+    __m256 y1 = gather_clamped(items, at, stride, vlo, vhi);
+    __m256 y2 = gather_clamped(items, at, 2 * stride, vlo, vhi);
+    __m256 t = _mm256_loadu_ps(tween + i);
+    __m256 c1 = _mm256_mul_ps(half, _mm256_sub_ps(y1, ym1));
+    __m256 c2 = _mm256_sub_ps(_mm256_add_ps(_mm256_sub_ps(ym1, _mm256_mul_ps(_mm256_set1_ps(2.5f), y0)),
+                                            _mm256_mul_ps(_mm256_set1_ps(2.0f), y1)),
+                              _mm256_mul_ps(half, y2));
+    __m256 c3 = _mm256_add_ps(_mm256_mul_ps(half, _mm256_sub_ps(y2, ym1)),
+                              _mm256_mul_ps(_mm256_set1_ps(1.5f), _mm256_sub_ps(y0, y1)));
+    __m256 v = _mm256_add_ps(_mm256_mul_ps(c3, t), c2);
+    v = _mm256_add_ps(_mm256_mul_ps(v, t), c1);
+    _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_mul_ps(v, t), y0));
+  }
+  fetch_cubic_scalar(out + i, items, index + i, stride, lo, hi, tween + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void fetch_sinc_avx2(float *out, const float *items, const int *index,
+                            int stride, int lo, int hi, const float *tween,
+                            int n, int octave) {
+  int taps = SINC_TAPS << octave;
+  const float *table = sinc_tables[octave];
+  const __m256i vlo = _mm256_set1_epi32(lo);
+  const __m256i vhi = _mm256_set1_epi32(hi);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 point = _mm256_mul_ps(_mm256_loadu_ps(tween + i), _mm256_set1_ps(SINC_PHASES));
+    __m256i phase = _mm256_cvttps_epi32(point);
+    __m256 frac = _mm256_sub_ps(point, _mm256_cvtepi32_ps(phase));
+    __m256i row = _mm256_mullo_epi32(phase, _mm256_set1_epi32(taps));
+    __m256i first = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i *) (index + i)),
+                                     _mm256_set1_epi32((taps / 2 - 1) * stride));
+    __m256 sum = _mm256_setzero_ps();
+
+    for (int k = 0; k < taps; ++k) {
+      __m256 ca = _mm256_i32gather_ps(table + k, row, 4);
+      __m256 cb = _mm256_i32gather_ps(table + k + taps, row, 4);
+      __m256 c = _mm256_add_ps(ca, _mm256_mul_ps(_mm256_sub_ps(cb, ca), frac));
+      __m256 x = gather_clamped(items, first, k * stride, vlo, vhi);
+      sum = _mm256_add_ps(sum, _mm256_mul_ps(x, c));
+    }
+    _mm256_storeu_ps(out + i, sum);
+  }
+  fetch_sinc_scalar(out + i, items, index + i, stride, lo, hi, tween + i, n - i, octave);
+}
+
+__attribute__((target("avx2")))
+static void gain_avx2(float *buf, const float *amp, int n) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(buf + i, _mm256_mul_ps(_mm256_loadu_ps(buf + i),
+                                            _mm256_loadu_ps(amp + i)));
+  }
+  gain_scalar(buf + i, amp + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void pan_avx2(float *out_a, float *out_b, const float *in,
+                     float gain_a, float gain_b, int n) {
+  __m256 ga = _mm256_set1_ps(gain_a);
+  __m256 gb = _mm256_set1_ps(gain_b);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 v = _mm256_loadu_ps(in + i);
+    _mm256_storeu_ps(out_a + i, _mm256_add_ps(_mm256_loadu_ps(out_a + i),
+                                              _mm256_mul_ps(v, ga)));
+    _mm256_storeu_ps(out_b + i, _mm256_add_ps(_mm256_loadu_ps(out_b + i),
+                                              _mm256_mul_ps(v, gb)));
+  }
+  pan_scalar(out_a + i, out_b + i, in + i, gain_a, gain_b, n - i);
+}
+
+#endif
+
+t_kernels kernels = {"scalar", fetch_scalar, fetch_cubic_scalar, fetch_sinc_scalar,
+                     gain_scalar, pan_scalar};
+
+// Works out a Blackman windowed sinc for each octave. Tap k of the
+// row for a point t of the way from one frame to the next is for the
+// frame k - (taps / 2 - 1) away from the first, so t from it. Each row
+// is scaled to add up to 1, so the kernel doesn't change the level.
+
+static void init_sinc(void) {
+  for (int octave = 0; octave < SINC_OCTAVES; ++octave) {
+    int taps = SINC_TAPS << octave;
+    double cutoff = 1.0 / (1 << octave);
+    double radius = taps / 2;
+
+    for (int phase = 0; phase <= SINC_PHASES; ++phase) {
+      float *row = sinc_tables[octave] + phase * taps;
+      double t = (double) phase / SINC_PHASES;
+      double total = 0;
+
+      for (int k = 0; k < taps; ++k) {
+        double x = k - (taps / 2 - 1) - t;
+        double sinc = (x == 0) ? 1 : sin(M_PI * cutoff * x) / (M_PI * cutoff * x);
+        double window = (fabs(x) >= radius) ? 0
+          : 0.42 + 0.5 * cos(M_PI * x / radius) + 0.08 * cos(2 * M_PI * x / radius);
+        row[k] = (float) (sinc * window);
+        total += row[k];
+      }
+      for (int k = 0; k < taps; ++k) {
+        row[k] = (float) (row[k] / total);
+      }
+    }
+  }
+}
+
+void kernels_init(void) {
+  init_sinc();
+#ifdef KERNELS_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    kernels = (t_kernels) {"avx2", fetch_avx2, fetch_cubic_avx2, fetch_sinc_avx2,
+                           gain_avx2, pan_avx2};
+  }
+  else if (__builtin_cpu_supports("sse2")) {
+    kernels = (t_kernels) {"sse2", fetch_sse2, fetch_cubic_sse2, fetch_sinc_sse2,
+                           gain_sse2, pan_sse2};
+  }
+#endif
+}
@@ -0,0 +1,66 @@
+#ifndef __KERNELS_H__
+#define __KERNELS_H__
+
+// Block kernels for the hot end of sound playback. Each kernel has a
+// scalar version, plus SSE2 and AVX2 versions on x86 which are picked
+// at runtime according to what the CPU supports.
+
+// How samples are interpolated between frames, from cheapest to
+// cleanest. Per output value, linear reads 2 frames, cubic 4, and sinc
+// 8 at speeds up to 1, doubling with each octave of speed above that
+// up to 64, so it keeps out aliasing when pitching up by as much as 3
+// octaves. Sinc also reads two rows of coefficients per frame. With
+// AVX2, cubic takes about 1.6 times as long as linear, and sinc 4
+// times at speeds up to 1, then 6, 11 and 22 times for each octave
+// above.
+enum {
+  INTERP_LINEAR,
+  INTERP_CUBIC,
+  INTERP_SINC,
+  INTERP_QUALITIES
+};
+
+// the sinc kernel has this many taps per octave of speed above 1
+#define SINC_TAPS 8
+#define SINC_OCTAVES 4
+
+typedef struct {
+  const char *name;
+
+  // Fetches n interpolated values from items. index[i] and next[i] are
+  // offsets into items of the two frames to interpolate between,
+  // tween[i] the amount of the second one to take.
+  void (*fetch)(float *out, const float *items, const int *index,
+                const int *next, const float *tween, int n);
+
+  // Fetches n values from items with 4 point cubic (Catmull-Rom)
+  // interpolation. index[i] is the offset into items of the frame
+  // before the value, tween[i] how far past it the value is. The frames
+  // either side are stride apart, and any offsets outside lo to hi are
+  // clamped.
+  void (*fetch_cubic)(float *out, const float *items, const int *index,
+                      int stride, int lo, int hi, const float *tween, int n);
+
+  // As fetch_cubic, but with a windowed sinc of SINC_TAPS << octave
+  // taps, band limited to 1 / (1 << octave) of the Nyquist frequency
+  void (*fetch_sinc)(float *out, const float *items, const int *index,
+                     int stride, int lo, int hi, const float *tween, int n,
+                     int octave);
+
+  // Multiplies n values in buf by the corresponding values in amp
+  void (*gain)(float *buf, const float *amp, int n);
+
+  // Adds n values from in to out_a and out_b, scaled by gain_a and
+  // gain_b respectively
+  void (*pan)(float *out_a, float *out_b, const float *in,
+              float gain_a, float gain_b, int n);
+} t_kernels;
+
+extern t_kernels kernels;
+
+// Picks the fastest kernels the CPU supports, and works out the sinc
+// kernel's coefficients
+//
+void kernels_init(void);
+
+#endif
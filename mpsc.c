@@ -0,0 +1,56 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "mpsc.h"
+
+struct mpsc {
+    void** items;
+    unsigned int mask;
+
+    // next place to push to, shared by the producers
+    uint64_t tail;
+    // next place to pop from, only touched by the consumer
+    uint64_t head;
+};
+
+mpsc_t* mpsc_init(unsigned int size) {
+    unsigned int places = 1;
+    while (places < size) {
+        places <<= 1;
+    }
+
+    mpsc_t* q = malloc(sizeof(mpsc_t));
+    if (q == NULL) return NULL;
+
+    q->items = calloc(places, sizeof(void*));
+    if (q->items == NULL) {
+        free(q);
+        return NULL;
+    }
+
+    q->mask = places - 1;
+    q->tail = 0;
+    q->head = 0;
+    return q;
+}
+
+void mpsc_push(mpsc_t* q, void* item) {
+    uint64_t place = __atomic_fetch_add(&q->tail, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&q->items[place & q->mask], item, __ATOMIC_RELEASE);
+}
+
+void* mpsc_pop(mpsc_t* q) {
+    void** place = &q->items[q->head & q->mask];
+    void* item = __atomic_load_n(place, __ATOMIC_ACQUIRE);
+
+    if (item != NULL) {
+        __atomic_store_n(place, NULL, __ATOMIC_RELAXED);
+        q->head++;
+    }
+    return item;
+}
+
+void mpsc_destroy(mpsc_t* q) {
+    free(q->items);
+    free(q);
+}
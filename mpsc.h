@@ -0,0 +1,33 @@
+#ifndef __MPSC_H__
+#define __MPSC_H__
+
+#include <stdbool.h>
+
+// A bounded queue of pointers from any number of producer threads to
+// a single consumer, intended for handing work to an audio callback.
+// Pushing is wait-free, popping never blocks: an item a producer has
+// claimed a place for but not yet stored holds up the ones behind it
+// until the next pop.
+
+typedef struct mpsc mpsc_t;
+
+// Initialize a queue of at least size places
+//
+// Pushes never fail, so there must never be more than size items
+// pushed and not yet popped.
+//
+mpsc_t* mpsc_init(unsigned int size);
+
+// Push a non-NULL item onto the queue, from any thread
+void mpsc_push(mpsc_t* q, void* item);
+
+// Removes and returns the oldest item, or NULL if there is none ready
+//
+// Only one thread may pop from a queue.
+//
+void* mpsc_pop(mpsc_t* q);
+
+// De-allocates the queue, items are not freed
+void mpsc_destroy(mpsc_t* q);
+
+#endif
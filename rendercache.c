@@ -0,0 +1,204 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "rendercache.h"
+
+#define BUCKETS 1024
+
+struct rendercache_entry {
+    // chains of the hash table, and the list from most to least
+    // recently used
+    rendercache_entry_t* next;
+    rendercache_entry_t* newer;
+    rendercache_entry_t* older;
+
+    uint64_t hash;
+    unsigned int refs;
+    bool ready;
+    bool failed;
+
+    float* samples;
+    unsigned int channels;
+    unsigned int frames;
+
+    size_t size;
+    unsigned char key[];
+};
+
+struct rendercache {
+    pthread_mutex_t lock;
+    size_t budget;
+    size_t used;
+    // set when an entry's let go of with the cache over its budget, so
+    // it's trimmed next time round
+    bool trim;
+
+    rendercache_entry_t* buckets[BUCKETS];
+    rendercache_entry_t* newest;
+    rendercache_entry_t* oldest;
+};
+
+rendercache_t* rendercache_init(size_t budget) {
+    rendercache_t* c = calloc(1, sizeof(rendercache_t));
+    if (c == NULL) return NULL;
+
+    pthread_mutex_init(&c->lock, NULL);
+    c->budget = budget;
+    return c;
+}
+
+// FNV-1a
+static uint64_t hash_key(const void* key, size_t size) {
+    const unsigned char* p = key;
+    uint64_t hash = 14695981039346656037ull;
+
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ p[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+static void unlink_entry(rendercache_t* c, rendercache_entry_t* e) {
+    if (e->newer) e->newer->older = e->older;
+    else c->newest = e->older;
+    if (e->older) e->older->newer = e->newer;
+    else c->oldest = e->newer;
+    e->newer = e->older = NULL;
+}
+
+static void link_newest(rendercache_t* c, rendercache_entry_t* e) {
+    e->older = c->newest;
+    e->newer = NULL;
+    if (c->newest) c->newest->newer = e;
+    else c->oldest = e;
+    c->newest = e;
+}
+
+// Return the bytes an entry takes up, samples and all
+static size_t entry_size(const rendercache_entry_t* e) {
+    return sizeof(rendercache_entry_t) + e->size
+        + (size_t) e->channels * e->frames * sizeof(float);
+}
+
+static void remove_entry(rendercache_t* c, rendercache_entry_t* e) {
+    rendercache_entry_t** p = &c->buckets[e->hash % BUCKETS];
+
+    while (*p != e) {
+        p = &(*p)->next;
+    }
+    *p = e->next;
+    unlink_entry(c, e);
+    c->used -= entry_size(e);
+    free(e->samples);
+    free(e);
+}
+
+// Throws out unused entries, least recently used first, until the
+// cache is back within its budget. Failed entries are kept like the
+// rest, so they aren't tried again every time.
+static void evict(rendercache_t* c) {
+    rendercache_entry_t* e = c->oldest;
+
+    __atomic_store_n(&c->trim, false, __ATOMIC_RELAXED);
+    while (e != NULL && c->used > c->budget) {
+        rendercache_entry_t* newer = e->newer;
+        bool unused = __atomic_load_n(&e->refs, __ATOMIC_ACQUIRE) == 0;
+
+        if (unused && (e->failed || e->ready)) {
+            remove_entry(c, e);
+        }
+        e = newer;
+    }
+}
+
+rendercache_entry_t* rendercache_get(rendercache_t* c, const void* key, size_t size,
+                                     bool* added) {
+    uint64_t hash = hash_key(key, size);
+    rendercache_entry_t* e;
+
+    pthread_mutex_lock(&c->lock);
+    if (__atomic_load_n(&c->trim, __ATOMIC_RELAXED)) {
+        evict(c);
+    }
+    for (e = c->buckets[hash % BUCKETS]; e != NULL; e = e->next) {
+        if (e->hash == hash && e->size == size && memcmp(e->key, key, size) == 0) {
+            break;
+        }
+    }
+
+    if (e != NULL) {
+        unlink_entry(c, e);
+        link_newest(c, e);
+        *added = false;
+    }
+    else {
+        e = calloc(1, sizeof(rendercache_entry_t) + size);
+        if (e == NULL) {
+            pthread_mutex_unlock(&c->lock);
+            return NULL;
+        }
+        e->hash = hash;
+        e->size = size;
+        memcpy(e->key, key, size);
+        e->next = c->buckets[hash % BUCKETS];
+        c->buckets[hash % BUCKETS] = e;
+        link_newest(c, e);
+        c->used += entry_size(e);
+        *added = true;
+    }
+    __atomic_add_fetch(&e->refs, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&c->lock);
+    return e;
+}
+
+void rendercache_fill(rendercache_t* c, rendercache_entry_t* e, float* samples,
+                      unsigned int channels, unsigned int frames) {
+    pthread_mutex_lock(&c->lock);
+    if (samples == NULL) {
+        e->failed = true;
+    }
+    else {
+        e->samples = samples;
+        e->channels = channels;
+        e->frames = frames;
+        c->used += (size_t) channels * frames * sizeof(float);
+        __atomic_store_n(&e->ready, true, __ATOMIC_RELEASE);
+    }
+    evict(c);
+    pthread_mutex_unlock(&c->lock);
+}
+
+bool rendercache_ready(const rendercache_entry_t* e) {
+    return __atomic_load_n(&e->ready, __ATOMIC_ACQUIRE);
+}
+
+const float* rendercache_samples(const rendercache_entry_t* e, unsigned int channel) {
+    return e->samples + (size_t) channel * e->frames;
+}
+
+unsigned int rendercache_frames(const rendercache_entry_t* e) {
+    return e->frames;
+}
+
+void rendercache_release(rendercache_t* c, rendercache_entry_t* e) {
+    if (__atomic_sub_fetch(&e->refs, 1, __ATOMIC_RELEASE) == 0
+        && __atomic_load_n(&c->used, __ATOMIC_RELAXED) > c->budget) {
+        __atomic_store_n(&c->trim, true, __ATOMIC_RELAXED);
+    }
+}
+
+void rendercache_destroy(rendercache_t* c) {
+    for (int i = 0; i < BUCKETS; ++i) {
+        rendercache_entry_t* e = c->buckets[i];
+        while (e != NULL) {
+            rendercache_entry_t* next = e->next;
+            free(e->samples);
+            free(e);
+            e = next;
+        }
+    }
+    pthread_mutex_destroy(&c->lock);
+    free(c);
+}
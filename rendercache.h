@@ -0,0 +1,64 @@
+#ifndef __RENDERCACHE_H__
+#define __RENDERCACHE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// A cache of rendered sounds, looked up by a key of whatever it takes
+// to decide what they sound like. Entries are rendered once, outside
+// the audio thread, and kept within a budget of memory, throwing out
+// the least recently used. An entry in use holds a reference, which
+// keeps it from being thrown out.
+//
+// All but rendercache_release() and the accessors take a lock, and may
+// allocate or free memory, so are not for the audio thread.
+
+typedef struct rendercache rendercache_t;
+typedef struct rendercache_entry rendercache_entry_t;
+
+// Initialize a cache of at most budget bytes of samples
+//
+rendercache_t* rendercache_init(size_t budget);
+
+// Looks up the entry for a key of size bytes, adding an empty one if
+// there isn't one, and takes a reference to it. Entries let go of
+// since the cache went over its budget are thrown out first.
+//
+// added is set if the entry was added, in which case the caller is to
+// render it and hand the samples over with rendercache_fill().
+//
+rendercache_entry_t* rendercache_get(rendercache_t* c, const void* key, size_t size,
+                                     bool* added);
+
+// Hands over the samples of an entry, frames values for each of
+// channels channels one after another, allocated with malloc()
+//
+// The cache takes ownership of the samples. NULL samples mark the
+// entry as failed, so it's never ready, and isn't rendered again until
+// it's thrown out.
+//
+void rendercache_fill(rendercache_t* c, rendercache_entry_t* e, float* samples,
+                      unsigned int channels, unsigned int frames);
+
+// Return whether an entry's samples are ready to use
+bool rendercache_ready(const rendercache_entry_t* e);
+
+// Return the samples of one channel of a ready entry
+const float* rendercache_samples(const rendercache_entry_t* e, unsigned int channel);
+
+// Return how many frames a ready entry has
+unsigned int rendercache_frames(const rendercache_entry_t* e);
+
+// Drops a reference to an entry
+//
+// This takes no lock and frees nothing, so may be called from the
+// audio thread. If the cache is over its budget, unused entries are
+// thrown out the next time it's looked up or filled.
+//
+void rendercache_release(rendercache_t* c, rendercache_entry_t* e);
+
+// De-allocates the cache and its entries, which must no longer be in
+// use
+void rendercache_destroy(rendercache_t* c);
+
+#endif
@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+
+#include "renderpool.h"
+
+// how many times to check on jobs other threads are part way through
+// before giving up the processor to let them finish
+#define SPIN_LIMIT 4096
+
+struct renderpool {
+    pthread_t* threads;
+    unsigned int num_threads;
+    t_render_job fn;
+    void* arg;
+
+    sem_t wake;
+
+    // number of jobs in the upper 32 bits, next job to claim in the
+    // lower, so a claim always sees the job count it belongs to
+    uint64_t claim;
+    // threads that may be between claiming and finishing a job
+    unsigned int busy;
+
+    bool running;
+    bool scheduled;
+    // set if the threads couldn't be given the caller's scheduling, so
+    // jobs are all run by the caller
+    bool inline_only;
+};
+
+typedef struct {
+    renderpool_t* pool;
+    unsigned int worker;
+} worker_t;
+
+// Claims and runs jobs until there are none left
+static void run_jobs(renderpool_t* p, unsigned int worker) {
+    while (true) {
+        uint64_t claim = __atomic_fetch_add(&p->claim, 1, __ATOMIC_ACQ_REL);
+        unsigned int job = (unsigned int) claim;
+        if (job >= (unsigned int) (claim >> 32)) break;
+        p->fn(worker, job, p->arg);
+    }
+}
+
+static void* thread_do(void* arg) {
+    worker_t* w = arg;
+    renderpool_t* p = w->pool;
+
+    while (true) {
+        sem_wait(&p->wake);
+        if (!__atomic_load_n(&p->running, __ATOMIC_ACQUIRE)) break;
+
+        __atomic_fetch_add(&p->busy, 1, __ATOMIC_ACQ_REL);
+        run_jobs(p, w->worker);
+        __atomic_fetch_sub(&p->busy, 1, __ATOMIC_RELEASE);
+    }
+
+    free(w);
+    pthread_exit(NULL);
+}
+
+renderpool_t* renderpool_init(unsigned int num_threads, t_render_job fn, void *arg) {
+    renderpool_t* p = calloc(1, sizeof(renderpool_t));
+    if (!p) return NULL;
+
+    p->threads = malloc(sizeof(pthread_t) * num_threads);
+    if (!p->threads) {
+        free(p);
+        return NULL;
+    }
+
+    p->fn = fn;
+    p->arg = arg;
+    p->running = true;
+    if (sem_init(&p->wake, 0, 0)) {
+        free(p->threads);
+        free(p);
+        return NULL;
+    }
+
+    // num_threads counts the threads started so far, so a failure
+    // part way through only stops those
+    for (unsigned int i = 0; i < num_threads; i++) {
+        worker_t* w = malloc(sizeof(worker_t));
+        if (!w) {
+            renderpool_destroy(p);
+            return NULL;
+        }
+        w->pool = p;
+        w->worker = i + 1;
+        if (pthread_create(&p->threads[i], NULL, thread_do, w)) {
+            free(w);
+            renderpool_destroy(p);
+            return NULL;
+        }
+        p->num_threads++;
+    }
+
+    return p;
+}
+
+void renderpool_run(renderpool_t* p, unsigned int num_jobs) {
+    if (!p->scheduled) {
+        // one-off, so it's fine for this to make syscalls
+        struct sched_param param;
+        int policy;
+        if (pthread_getschedparam(pthread_self(), &policy, &param) == 0) {
+            for (unsigned int i = 0; i < p->num_threads; i++) {
+                if (pthread_setschedparam(p->threads[i], policy, &param) != 0
+                    && policy != SCHED_OTHER) {
+                    p->inline_only = true;
+                }
+            }
+        }
+        if (p->inline_only) {
+            // waiting on threads the caller can starve of the processor
+            // could go on forever
+            fprintf(stderr, "could not give render workers realtime scheduling, "
+                    "rendering on the audio thread\n");
+        }
+        p->scheduled = true;
+    }
+
+    __atomic_store_n(&p->claim, (uint64_t) num_jobs << 32, __ATOMIC_RELEASE);
+
+    if (p->inline_only) {
+        run_jobs(p, 0);
+        return;
+    }
+
+    // there's no point waking more threads than there are jobs to go
+    // round, and the calling thread takes one of them
+    unsigned int wake = num_jobs - 1;
+    if (wake > p->num_threads) wake = p->num_threads;
+    for (unsigned int i = 0; i < wake; i++) {
+        sem_post(&p->wake);
+    }
+
+    // every job nobody else has got to is run here, so this only ends
+    // up waiting on those other threads are part way through
+    run_jobs(p, 0);
+
+    for (unsigned int spins = 0; __atomic_load_n(&p->busy, __ATOMIC_ACQUIRE) != 0; spins++) {
+        if (spins < SPIN_LIMIT) {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+        }
+        else {
+            // one of them must have been preempted, maybe on this
+            // processor, which it gets to finish on
+            sched_yield();
+        }
+    }
+}
+
+unsigned int renderpool_size(const renderpool_t* p) {
+    return p->num_threads;
+}
+
+void renderpool_destroy(renderpool_t* p) {
+    __atomic_store_n(&p->running, false, __ATOMIC_RELEASE);
+
+    for (unsigned int i = 0; i < p->num_threads; i++) {
+        sem_post(&p->wake);
+    }
+    for (unsigned int i = 0; i < p->num_threads; i++) {
+        pthread_join(p->threads[i], NULL);
+    }
+
+    sem_destroy(&p->wake);
+    free(p->threads);
+    free(p);
+}
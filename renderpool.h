@@ -0,0 +1,38 @@
+#ifndef __RENDERPOOL_H__
+#define __RENDERPOOL_H__
+
+#include <stdbool.h>
+
+// A pool of threads that share out a fixed number of jobs with the
+// thread asking for them to be run, intended for use from an audio
+// callback. Running jobs takes no locks: the calling thread wakes the
+// workers, claims jobs alongside them with an atomic counter and then
+// spins only until jobs other threads have already claimed are done.
+// That wait isn't bounded, so if a worker's been preempted, the caller
+// yields to let it finish rather than spin on.
+
+typedef struct renderpool renderpool_t;
+
+// Runs a job. worker is 0 for the thread calling renderpool_run(),
+// and 1 to the number of threads in the pool for the others.
+typedef void (*t_render_job)(unsigned int worker, unsigned int job, void *arg);
+
+// Initialize a pool of num_threads threads running fn
+//
+renderpool_t* renderpool_init(unsigned int num_threads, t_render_job fn, void *arg);
+
+// Runs jobs 0 to num_jobs - 1, returning once they are all done
+//
+// Worker threads take on the scheduling policy and priority of the
+// calling thread the first time this is called. If they can't be given
+// a realtime one, all jobs are run on the calling thread from then on.
+//
+void renderpool_run(renderpool_t* p, unsigned int num_jobs);
+
+// Return the number of threads in the pool, not counting the caller
+unsigned int renderpool_size(const renderpool_t* p);
+
+// Stops the threads and de-allocates the pool
+void renderpool_destroy(renderpool_t* p);
+
+#endif
@@ -106,8 +106,9 @@ int play_handler(const char *path, const char *types, lo_arg **argv,
 
   int orbit = argc > (30+poffset) ? argv[30+poffset]->i : 0;
   //printf("orb: %d\n", orbit);
+  int interpolation = argc > (31+poffset) ? argv[31+poffset]->i : -1;
   static bool extraWarned = false;
-  if (argc > 31+poffset && !extraWarned) {
+  if (argc > 32+poffset && !extraWarned) {
     printf("play server unexpectedly received extra parameters, maybe update Dirt?\n");
     extraWarned = true;
   }
@@ -172,7 +173,7 @@ int play_handler(const char *path, const char *types, lo_arg **argv,
   sound->offset = offset;
   sound->cps = cps;
   sound->when = when;
-  sound->orbit = (orbit <= MAX_ORBIT) ? orbit : MAX_ORBIT;
+  sound->orbit = (orbit < 0) ? 0 : (orbit < MAX_ORBIT) ? orbit : MAX_ORBIT - 1;
   //printf("orbit: %d\n", sound->orbit);
   if (sample_n) {
     sample_n = abs(sample_n);
@@ -186,6 +187,7 @@ int play_handler(const char *path, const char *types, lo_arg **argv,
   sound->attack = attack;
   sound->hold = hold;
   sound->release = release;
+  sound->interpolation = interpolation;
 
   audio_play(sound);
 
@@ -194,6 +196,31 @@ int play_handler(const char *path, const char *types, lo_arg **argv,
 
 /**/
 
+// Replies to the sender with how the polyphony governor is doing:
+// the limit, its cap, the sounds playing, the render load, and how many
+// sounds have been culled at the cap and with the limit brought down
+// below it, then how many duplicate sounds have been merged
+
+int stats_handler(const char *path, const char *types, lo_arg **argv,
+                  int argc, void *data, void *user_data) {
+  governor_stats_t stats;
+  lo_address source = lo_message_get_source(data);
+
+  audio_stats(&stats);
+  lo_send(source, "/stats", "iiifiii",
+          (int) stats.limit,
+          (int) stats.cap,
+          (int) stats.playing,
+          stats.load,
+          (int) stats.culled[CULL_CAP],
+          (int) stats.culled[CULL_LOAD],
+          (int) audio_merged()
+          );
+  return(0);
+}
+
+/**/
+
 #ifdef ZEROMQ
 void *zmqthread(void *data){
   void *context = zmq_ctx_new ();
@@ -250,6 +277,7 @@ extern int server_init(const char *osc_port) {
   lo_server_thread st = lo_server_thread_new(osc_port, error);
 
   lo_server_thread_add_method(st, "/play", NULL, play_handler, NULL);
+  lo_server_thread_add_method(st, "/stats", "", stats_handler, NULL);
 
   lo_server_thread_add_method(st, NULL, NULL, generic_handler, NULL);
   lo_server_thread_start(st);